@@ -0,0 +1,125 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2019 Pierre Lindenbaum PhD.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+#ifndef BINNING_H
+#define BINNING_H
+#include <cstddef>
+#include <climits>
+#include <stdint.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/** min, max and sum of the 'n' values of 'p'. Vectorized with AVX2 or SSE2 when available */
+static inline void reduceMinMaxSum(const int* p,size_t n,int* out_min,int* out_max,int64_t* out_sum) {
+	int mn = INT_MAX;
+	int mx = INT_MIN;
+	int64_t sum = 0;
+	size_t i=0;
+	// lane sums are flushed to 64 bits every FLUSH vectors so they cannot overflow for depth < 2^19
+	const size_t FLUSH = 4096;
+#if defined(__AVX2__)
+	if(n>=8) {
+		__m256i vmin = _mm256_set1_epi32(INT_MAX);
+		__m256i vmax = _mm256_set1_epi32(INT_MIN);
+		while(i+8<=n) {
+			__m256i vsum = _mm256_setzero_si256();
+			for(size_t k=0;k< FLUSH && i+8<=n;k++,i+=8) {
+				__m256i x = _mm256_loadu_si256((const __m256i*)(p+i));
+				vmin = _mm256_min_epi32(vmin,x);
+				vmax = _mm256_max_epi32(vmax,x);
+				vsum = _mm256_add_epi32(vsum,x);
+				}
+			int32_t tmp[8];
+			_mm256_storeu_si256((__m256i*)tmp,vsum);
+			for(int k=0;k<8;k++) sum+=tmp[k];
+			}
+		int32_t tmin[8],tmax[8];
+		_mm256_storeu_si256((__m256i*)tmin,vmin);
+		_mm256_storeu_si256((__m256i*)tmax,vmax);
+		for(int k=0;k<8;k++) {
+			if(tmin[k]<mn) mn=tmin[k];
+			if(tmax[k]>mx) mx=tmax[k];
+			}
+		}
+#elif defined(__SSE2__)
+	if(n>=4) {
+		// SSE2 has no min/max for 32-bit integers: use compare and select
+		__m128i vmin = _mm_set1_epi32(INT_MAX);
+		__m128i vmax = _mm_set1_epi32(INT_MIN);
+		while(i+4<=n) {
+			__m128i vsum = _mm_setzero_si128();
+			for(size_t k=0;k< FLUSH && i+4<=n;k++,i+=4) {
+				__m128i x = _mm_loadu_si128((const __m128i*)(p+i));
+				__m128i lt = _mm_cmplt_epi32(x,vmin);
+				vmin = _mm_or_si128(_mm_and_si128(lt,x),_mm_andnot_si128(lt,vmin));
+				__m128i gt = _mm_cmpgt_epi32(x,vmax);
+				vmax = _mm_or_si128(_mm_and_si128(gt,x),_mm_andnot_si128(gt,vmax));
+				vsum = _mm_add_epi32(vsum,x);
+				}
+			int32_t tmp[4];
+			_mm_storeu_si128((__m128i*)tmp,vsum);
+			for(int k=0;k<4;k++) sum+=tmp[k];
+			}
+		int32_t tmin[4],tmax[4];
+		_mm_storeu_si128((__m128i*)tmin,vmin);
+		_mm_storeu_si128((__m128i*)tmax,vmax);
+		for(int k=0;k<4;k++) {
+			if(tmin[k]<mn) mn=tmin[k];
+			if(tmax[k]>mx) mx=tmax[k];
+			}
+		}
+#endif
+	for(;i< n;i++) {
+		if(p[i]<mn) mn=p[i];
+		if(p[i]>mx) mx=p[i];
+		sum+=p[i];
+		}
+	*out_min = mn;
+	*out_max = mx;
+	*out_sum = sum;
+	}
+
+/** downsample the 'n' values of 'depth' into 'n_bins' columns and get the min, mean and max of each column,
+ * any output may be NULL. Column 'i' covers the values [i*n/n_bins, max(i*n/n_bins+1,(i+1)*n/n_bins) ).
+ */
+static inline void binMinMeanMax(const int* depth,size_t n,size_t n_bins,float* out_min,float* out_mean,float* out_max) {
+	if(n==0) return;
+	for(size_t i=0;i< n_bins;i++) {
+		size_t g1 = (size_t)(((uint64_t)i*n)/n_bins);
+		size_t g2 = (size_t)(((uint64_t)(i+1)*n)/n_bins);
+		if(g1>=n) g1=n-1;
+		if(g2<=g1) g2=g1+1;
+		int mn,mx;
+		int64_t sum;
+		reduceMinMaxSum(depth+g1,g2-g1,&mn,&mx,&sum);
+		if(out_min!=NULL) out_min[i] = (float)mn;
+		if(out_mean!=NULL) out_mean[i] = (float)(sum/(double)(g2-g1));
+		if(out_max!=NULL) out_max[i] = (float)mx;
+		}
+	}
+
+#endif
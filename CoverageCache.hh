@@ -0,0 +1,153 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2019 Pierre Lindenbaum PhD.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+#ifndef COVERAGE_CACHE_H
+#define COVERAGE_CACHE_H
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "RunLength.hh"
+
+/** a directory of base-level coverage files. Each file is named after a hash of its key,
+ * which is also stored in the file to detect collisions. A file holds one or more tracks of
+ * the same length; each track is run-length encoded as a uint32 number of runs followed by
+ * pairs of uint32 (run length, depth), so the file can be used in place after mmap.
+ */
+class CoverageCache
+	{
+	private:
+		struct Header
+			{
+			char magic[8];
+			uint32_t key_length;
+			uint32_t length;
+			uint32_t n_tracks;
+			uint32_t reserved;
+			};
+		std::string directory;
+
+		static uint64_t hash(const std::string& s) {
+			uint64_t x = 14695981039346656037ULL;
+			for(size_t i=0;i< s.size();i++) x = (x ^ (unsigned char)s[i]) * 1099511628211ULL;
+			return x;
+			}
+		std::string path(const std::string& key) const {
+			char tmp[40];
+			sprintf(tmp,"/%016llx.cov",(unsigned long long)hash(key));
+			return directory + tmp;
+			}
+		static size_t padded(size_t n) {
+			return (n+3) & ~((size_t)3);
+			}
+	public:
+		CoverageCache(const char* dir):directory(dir) {
+			if(::mkdir(dir,0755)!=0 && errno!=EEXIST) {
+				fprintf(stderr,"[WARN] cannot create cache directory %s: %s\n",dir,strerror(errno));
+				}
+			}
+		/** fill 'tracks' from the file of 'key', whose runs are used as they are. Return false if there is no such file or if it doesn't have tracks.size() tracks */
+		bool load(const std::string& key,std::vector<RunLengthCoverage>& tracks) const {
+			std::string fn = path(key);
+			int fd = ::open(fn.c_str(),O_RDONLY);
+			if(fd<0) return false;
+			struct stat st;
+			bool ok = false;
+			if(::fstat(fd,&st)==0 && (size_t)st.st_size >= sizeof(Header)) {
+				void* mem = ::mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+				if(mem!=MAP_FAILED) {
+					const Header* h = (const Header*)mem;
+					const char* key2 = (const char*)mem + sizeof(Header);
+					const uint32_t* p = (const uint32_t*)(key2 + padded(h->key_length));
+					const uint32_t* p_end = (const uint32_t*)((const char*)mem + st.st_size);
+					if(memcmp(h->magic,"X11COV2",8)==0 &&
+						sizeof(Header) + padded(h->key_length) <= (size_t)st.st_size &&
+						h->key_length==key.size() && memcmp(key2,key.data(),key.size())==0 &&
+						h->n_tracks==tracks.size()) {
+						ok = true;
+						for(size_t t=0;ok && t< tracks.size();t++) {
+							RunLengthCoverage& coverage = tracks[t];
+							coverage.clear();
+							if(p>=p_end) { ok=false; break;}
+							uint32_t n_runs = *p++;
+							if((size_t)(p_end-p) < (size_t)n_runs*2) { ok=false; break;}
+							for(uint32_t i=0;i< n_runs && coverage.length() < h->length;i++,p+=2) {
+								coverage.push(std::min((size_t)p[0],h->length-coverage.length()),(int)p[1]);
+								}
+							ok = (coverage.length()==h->length);
+							}
+						}
+					::munmap(mem,(size_t)st.st_size);
+					}
+				}
+			::close(fd);
+			return ok;
+			}
+		/** save 'tracks', which must have the same length, under 'key'. The file is written under a temporary name, then renamed */
+		void save(const std::string& key,const std::vector<RunLengthCoverage>& tracks) const {
+			std::vector<uint32_t> runs;
+			size_t length = (tracks.empty()?0:tracks[0].length());
+			for(size_t t=0;t< tracks.size();t++) {
+				const RunLengthCoverage& coverage = tracks[t];
+				runs.push_back((uint32_t)coverage.runs());
+				for(size_t r=0;r< coverage.runs();r++) {
+					runs.push_back((uint32_t)coverage.runLength(r));
+					runs.push_back((uint32_t)std::max(0,coverage.depth(r)));
+					}
+				}
+			Header h;
+			memset(&h,0,sizeof(Header));
+			memcpy(h.magic,"X11COV2",8);
+			h.key_length = (uint32_t)key.size();
+			h.length = (uint32_t)length;
+			h.n_tracks = (uint32_t)tracks.size();
+			std::string fn = path(key);
+			// several processes or threads may save the same key
+			static std::atomic<unsigned int> n_saved(0);
+			char suffix[40];
+			sprintf(suffix,".tmp.%d.%u",(int)::getpid(),n_saved++);
+			std::string tmp = fn + suffix;
+			FILE* out = fopen(tmp.c_str(),"wb");
+			if(out==NULL) return;
+			const char zeros[4]={0,0,0,0};
+			bool ok = fwrite(&h,sizeof(Header),1,out)==1 &&
+				fwrite(key.data(),1,key.size(),out)==key.size() &&
+				fwrite(zeros,1,padded(key.size())-key.size(),out)==padded(key.size())-key.size() &&
+				fwrite(runs.data(),sizeof(uint32_t),runs.size(),out)==runs.size();
+			ok = (fclose(out)==0) && ok;
+			if(!ok || ::rename(tmp.c_str(),fn.c_str())!=0) {
+				::unlink(tmp.c_str());
+				}
+			}
+	};
+
+#endif
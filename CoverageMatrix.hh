@@ -0,0 +1,127 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2019 Pierre Lindenbaum PhD.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+#ifndef COVERAGE_MATRIX_H
+#define COVERAGE_MATRIX_H
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/** a samples x bins matrix of float, stored row by row. Each row is padded to a multiple of 8 floats */
+class CoverageMatrix
+	{
+	private:
+		size_t n_rows;
+		size_t n_cols;
+		size_t stride;
+		std::vector<float> data;
+	public:
+		CoverageMatrix():n_rows(0),n_cols(0),stride(0) {
+			}
+		/** resize the matrix, all values are set to 0 */
+		void resize(size_t rows,size_t cols) {
+			this->n_rows = rows;
+			this->n_cols = cols;
+			this->stride = (cols+7) & ~((size_t)7);
+			this->data.assign(this->n_rows*this->stride,0.0f);
+			}
+		size_t rows() const { return n_rows;}
+		size_t cols() const { return n_cols;}
+		float* row(size_t i) { return &data[i*stride];}
+		const float* row(size_t i) const { return &data[i*stride];}
+		float get(size_t i,size_t j) const { return data[i*stride+j];}
+
+		/** for each column, compute the median and the median absolute deviation of the rows,
+		 * each row 'i' being first multiplied by scale[i]. Only the rows 'i' with mask[i]!=0 are used if 'mask' is not NULL.
+		 * 'scratch' holds the transposed matrix.
+		 */
+		void columnMedianMAD(const std::vector<float>& scale,std::vector<float>& median,std::vector<float>& mad,std::vector<float>& scratch,const char* mask=NULL) const {
+			median.assign(n_cols,0.0f);
+			mad.assign(n_cols,0.0f);
+			size_t n_valid = n_rows;
+			if(mask!=NULL) n_valid = (size_t)std::count_if(mask,mask+n_rows,[](char c) { return c!=0;});
+			if(n_valid==0) return;
+			scratch.resize(n_cols*n_valid);
+			// transpose by blocks of rows so a column is contiguous
+			const size_t BLOCK=64;
+			size_t k0=0;
+			for(size_t i0=0;i0< n_rows;i0+=BLOCK) {
+				size_t i1 = std::min(n_rows,i0+BLOCK);
+				size_t k=k0;
+				for(size_t j=0;j< n_cols;j++) {
+					float* col = &scratch[j*n_valid];
+					k=k0;
+					for(size_t i=i0;i< i1;i++) {
+						if(mask!=NULL && mask[i]==0) continue;
+						col[k++] = data[i*stride+j]*scale[i];
+						}
+					}
+				k0=k;
+				}
+			const size_t mid = n_valid/2;
+			for(size_t j=0;j< n_cols;j++) {
+				float* col = &scratch[j*n_valid];
+				std::nth_element(col,col+mid,col+n_valid);
+				float m = col[mid];
+				median[j] = m;
+				for(size_t i=0;i< n_valid;i++) col[i] = (col[i]<m?m-col[i]:col[i]-m);
+				std::nth_element(col,col+mid,col+n_valid);
+				mad[j] = col[mid];
+				}
+			}
+
+		/** out[i][j] = (this[i][j]*scale[i]-center[j])*inv_spread[j] : a z-score if center is the median
+		 * and inv_spread is 1/(1.4826*MAD), the ratio to the median minus 1 if center is the median and inv_spread
+		 * is 1/median (see X11BamCov::computeCohortTrack), the ratio itself if center is 0
+		 */
+		void standardize(const std::vector<float>& scale,const std::vector<float>& center,const std::vector<float>& inv_spread,CoverageMatrix& out) const {
+			out.resize(n_rows,n_cols);
+			for(size_t i=0;i< n_rows;i++) {
+				standardizeRow(i,scale[i],center,inv_spread,out);
+				}
+			}
+
+		/** the row 'i' of standardize, 'out' having the size of this matrix */
+		void standardizeRow(size_t i,float scale,const std::vector<float>& center,const std::vector<float>& inv_spread,CoverageMatrix& out) const {
+			const float* src = row(i);
+			float* dest = out.row(i);
+			size_t j=0;
+#ifdef __SSE2__
+			const __m128 s = _mm_set1_ps(scale);
+			for(;j+4<=n_cols;j+=4) {
+				__m128 x = _mm_mul_ps(_mm_loadu_ps(src+j),s);
+				x = _mm_sub_ps(x,_mm_loadu_ps(&center[j]));
+				_mm_storeu_ps(dest+j,_mm_mul_ps(x,_mm_loadu_ps(&inv_spread[j])));
+				}
+#endif
+			for(;j< n_cols;j++) {
+				dest[j] = (src[j]*scale-center[j])*inv_spread[j];
+				}
+			}
+	};
+
+#endif
@@ -0,0 +1,124 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2019 Pierre Lindenbaum PhD.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+#ifndef GC_CONTENT_H
+#define GC_CONTENT_H
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/** count the G/C and the A/C/G/T bases (any case) of the 'n' bases of 'seq'. Vectorized with SSE2 when available */
+static inline void countGC(const char* seq,size_t n,int64_t* out_gc,int64_t* out_acgt) {
+	int64_t gc = 0;
+	int64_t acgt = 0;
+	size_t i=0;
+#ifdef __SSE2__
+	// upper case by clearing bit 0x20, then compare; byte counters are flushed before they overflow
+	const __m128i upper = _mm_set1_epi8((char)0xDF);
+	const __m128i A = _mm_set1_epi8('A');
+	const __m128i C = _mm_set1_epi8('C');
+	const __m128i G = _mm_set1_epi8('G');
+	const __m128i T = _mm_set1_epi8('T');
+	const __m128i zero = _mm_setzero_si128();
+	while(i+16<=n) {
+		__m128i vgc = _mm_setzero_si128();
+		__m128i vat = _mm_setzero_si128();
+		for(int k=0;k< 255 && i+16<=n;k++,i+=16) {
+			__m128i x = _mm_and_si128(_mm_loadu_si128((const __m128i*)(seq+i)),upper);
+			__m128i is_gc = _mm_or_si128(_mm_cmpeq_epi8(x,G),_mm_cmpeq_epi8(x,C));
+			__m128i is_at = _mm_or_si128(_mm_cmpeq_epi8(x,A),_mm_cmpeq_epi8(x,T));
+			// a match is -1
+			vgc = _mm_sub_epi8(vgc,is_gc);
+			vat = _mm_sub_epi8(vat,is_at);
+			}
+		__m128i s1 = _mm_sad_epu8(vgc,zero);
+		__m128i s2 = _mm_sad_epu8(vat,zero);
+		int64_t n_gc = _mm_cvtsi128_si32(s1) + _mm_cvtsi128_si32(_mm_srli_si128(s1,8));
+		int64_t n_at = _mm_cvtsi128_si32(s2) + _mm_cvtsi128_si32(_mm_srli_si128(s2,8));
+		gc += n_gc;
+		acgt += n_gc + n_at;
+		}
+#endif
+	for(;i< n;i++) {
+		switch(seq[i]) {
+			case 'G': case 'g': case 'C': case 'c': gc++; acgt++; break;
+			case 'A': case 'a': case 'T': case 't': acgt++; break;
+			default: break;
+			}
+		}
+	*out_gc = gc;
+	*out_acgt = acgt;
+	}
+
+/** GC fraction of each of the 'n_bins' columns of 'seq', using the columns of binMinMeanMax. -1 for a column without any A/C/G/T */
+static inline void binGC(const char* seq,size_t n,size_t n_bins,float* out) {
+	for(size_t i=0;i< n_bins;i++) {
+		size_t g1 = (size_t)(((uint64_t)i*n)/n_bins);
+		size_t g2 = (size_t)(((uint64_t)(i+1)*n)/n_bins);
+		if(g1>=n) g1=(n==0?0:n-1);
+		if(g2<=g1) g2=std::min(n,g1+1);
+		int64_t gc,acgt;
+		countGC(seq+g1,g2-g1,&gc,&acgt);
+		out[i] = (acgt==0?-1.0f:(float)(gc/(double)acgt));
+		}
+	}
+
+#define GC_STRATA 50
+/** correct the 'n' binned depths of one sample for the GC bias: the bins are grouped by GC fraction in GC_STRATA strata,
+ * and each depth is multiplied by the median of all the bins over the median of its stratum. Bins without GC, or in
+ * a stratum of less than 'min_bins' bins, are left as is.
+ */
+static inline void correctGC(const float* depth,const float* gc,size_t n,size_t min_bins,float* out,std::vector<float>& scratch) {
+	std::vector<float> strata[GC_STRATA];
+	scratch.clear();
+	for(size_t i=0;i< n;i++) {
+		out[i] = depth[i];
+		if(gc[i]<0.0f) continue;
+		int s = std::min(GC_STRATA-1,(int)(gc[i]*GC_STRATA));
+		strata[s].push_back(depth[i]);
+		scratch.push_back(depth[i]);
+		}
+	if(scratch.empty()) return;
+	std::nth_element(scratch.begin(),scratch.begin()+scratch.size()/2,scratch.end());
+	const float median = scratch[scratch.size()/2];
+	float factor[GC_STRATA];
+	for(int s=0;s< GC_STRATA;s++) {
+		factor[s] = 1.0f;
+		std::vector<float>& v = strata[s];
+		if(v.size()< min_bins || v.empty()) continue;
+		std::nth_element(v.begin(),v.begin()+v.size()/2,v.end());
+		float m = v[v.size()/2];
+		if(m>0.0f) factor[s] = median/m;
+		}
+	for(size_t i=0;i< n;i++) {
+		if(gc[i]<0.0f) continue;
+		out[i] = depth[i]*factor[std::min(GC_STRATA-1,(int)(gc[i]*GC_STRATA))];
+		}
+	}
+
+#endif
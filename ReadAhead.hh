@@ -0,0 +1,120 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2019 Pierre Lindenbaum PhD.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+#include <string>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <htslib/hts.h>
+
+/** a BGZF block holds at most 64 KB of compressed data */
+#define READAHEAD_MAX_BLOCK 0x10000
+
+/** prefetch of the compressed blocks read by an index query. The chunks of the query are known as soon as the
+ * iterator is created: they are sorted, the chunks closer than 'gap' bytes are coalesced into one range, and
+ * the kernel is asked to read each range in the page cache with posix_fadvise(WILLNEED), in large requests and
+ * before BGZF asks for its blocks one by one. The advice is given on a descriptor of our own: the page cache is
+ * shared by all the handles on the file. Only for local files (including NFS mounts), a no-op for URLs.
+ */
+class ReadAhead
+	{
+	private:
+		int fd;
+		uint64_t gap;
+	public:
+		/** queries with at least one chunk */
+		std::atomic<uint64_t> n_queries;
+		/** chunks of the index, and ranges advised after coalescing */
+		std::atomic<uint64_t> n_chunks;
+		std::atomic<uint64_t> n_ranges;
+		std::atomic<uint64_t> n_bytes;
+
+		ReadAhead(const std::string& fn,uint64_t gap):fd(-1),gap(gap),n_queries(0),n_chunks(0),n_ranges(0),n_bytes(0) {
+			if(fn.find("://")==std::string::npos) fd = ::open(fn.c_str(),O_RDONLY);
+			}
+		~ReadAhead() {
+			if(fd>=0) ::close(fd);
+			}
+		bool enabled() const { return fd>=0;}
+
+		/** advise the compressed ranges of 'iter', which may be NULL */
+		void prefetch(const hts_itr_t* iter) {
+			if(fd<0 || iter==NULL || iter->off==NULL || iter->n_off<=0) return;
+			n_queries++;
+			n_chunks+=iter->n_off;
+			// the chunks are sorted and do not overlap; the end of a chunk is in the block starting at v>>16
+			uint64_t start = iter->off[0].u>>16;
+			uint64_t end = (iter->off[0].v>>16) + READAHEAD_MAX_BLOCK;
+			for(int i=1;i<= iter->n_off;i++) {
+				if(i< iter->n_off && (iter->off[i].u>>16) <= end + gap) {
+					end = std::max(end,(uint64_t)(iter->off[i].v>>16) + READAHEAD_MAX_BLOCK);
+					continue;
+					}
+#ifdef POSIX_FADV_WILLNEED
+				::posix_fadvise(fd,(off_t)start,(off_t)(end-start),POSIX_FADV_WILLNEED);
+#endif
+				n_ranges++;
+				n_bytes+=(end-start);
+				if(i< iter->n_off) {
+					start = iter->off[i].u>>16;
+					end = (iter->off[i].v>>16) + READAHEAD_MAX_BLOCK;
+					}
+				}
+			}
+	};
+
+/** the read counters of this process from /proc/self/io (Linux): read-like system calls, bytes they returned,
+ * and bytes fetched from the storage, not from the page cache. 'ok' is false elsewhere.
+ */
+struct IOCounters
+	{
+	bool ok;
+	uint64_t read_calls;
+	uint64_t read_chars;
+	uint64_t storage_bytes;
+
+	static IOCounters current() {
+		IOCounters c;
+		memset(&c,0,sizeof(IOCounters));
+		FILE* in = fopen("/proc/self/io","r");
+		if(in==NULL) return c;
+		char name[64];
+		unsigned long long value;
+		while(fscanf(in,"%63[^:]: %llu\n",name,&value)==2) {
+			if(strcmp(name,"syscr")==0) c.read_calls = value;
+			else if(strcmp(name,"rchar")==0) c.read_chars = value;
+			else if(strcmp(name,"read_bytes")==0) { c.storage_bytes = value; c.ok = true;}
+			}
+		fclose(in);
+		return c;
+		}
+	};
+
+#endif
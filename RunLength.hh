@@ -0,0 +1,232 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2019 Pierre Lindenbaum PhD.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+#ifndef RUN_LENGTH_H
+#define RUN_LENGTH_H
+#include <vector>
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <stdint.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/** a base-level signal stored as runs of equal values: run 'r' covers [start(r),start(r+1)) with the value depth(r).
+ * The coverage of the sequencing data is piecewise constant, so the signal is kept exactly and the binning, smoothing
+ * and maximum only visit the runs.
+ */
+class RunLengthCoverage
+	{
+	private:
+		size_t n;
+		std::vector<uint32_t> starts;
+		std::vector<int> depths;
+		/** index of the run containing 'pos' < n, or the last run if pos==n */
+		size_t runAt(size_t pos) const {
+			return (size_t)(std::upper_bound(starts.begin(),starts.end(),(uint32_t)pos)-starts.begin())-1;
+			}
+		size_t runEnd(size_t r) const { return r+1< starts.size()?starts[r+1]:n;}
+	public:
+		RunLengthCoverage():n(0) {
+			}
+		size_t length() const { return n;}
+		size_t runs() const { return depths.size();}
+		size_t start(size_t r) const { return starts[r];}
+		size_t runLength(size_t r) const { return runEnd(r)-starts[r];}
+		int depth(size_t r) const { return depths[r];}
+		/** memory used by the runs */
+		size_t bytes() const { return starts.capacity()*sizeof(uint32_t)+depths.capacity()*sizeof(int);}
+		void clear() {
+			n = 0;
+			starts.clear();
+			depths.clear();
+			}
+		/** append 'len' bases of 'depth', extending the last run if it has the same value */
+		void push(size_t len,int depth) {
+			if(len==0) return;
+			if(depths.empty() || depths.back()!=depth) {
+				starts.push_back((uint32_t)n);
+				depths.push_back(depth);
+				}
+			n += len;
+			}
+		/** replace the runs by those of the 'len' values of 'p'. Identical neighbours are skipped a vector at a time */
+		void encode(const int* p,size_t len) {
+			clear();
+			size_t i=0;
+			while(i< len) {
+				size_t j=i+1;
+#if defined(__AVX2__)
+				const __m256i v = _mm256_set1_epi32(p[i]);
+				while(j+8<=len && _mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(p+j)),v))==-1) j+=8;
+#elif defined(__SSE2__)
+				const __m128i v = _mm_set1_epi32(p[i]);
+				while(j+4<=len && _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(p+j)),v))==0xFFFF) j+=4;
+#endif
+				while(j< len && p[j]==p[i]) j++;
+				push(j-i,p[i]);
+				i=j;
+				}
+			}
+		/** replace the runs by the 'len' values of 'other' from 'from' */
+		void assign(const RunLengthCoverage& other,size_t from,size_t len) {
+			clear();
+			if(len==0 || from>=other.n) return;
+			const size_t end = std::min(other.n,from+len);
+			for(size_t r=other.runAt(from);r< other.runs() && other.starts[r]< end;r++) {
+				push(std::min(end,other.runEnd(r))-std::max(from,(size_t)other.starts[r]),other.depths[r]);
+				}
+			}
+		/** replace the runs by those of 'other', each value being at most 'cap'. The neighbouring runs above the cap are merged */
+		void assignCapped(const RunLengthCoverage& other,int cap) {
+			clear();
+			for(size_t r=0;r< other.runs();r++) push(other.runLength(r),std::min(other.depths[r],cap));
+			}
+		/** value at 'pos' */
+		int at(size_t pos) const {
+			return depths[runAt(pos)];
+			}
+		/** highest value, INT_MIN if empty */
+		int max() const {
+			int mx = INT_MIN;
+			for(size_t r=0;r< depths.size();r++) mx = std::max(mx,depths[r]);
+			return mx;
+			}
+		/** this[offset+i] += other[i]. The bases between the end of this signal and 'offset' are 0. Only the runs after 'offset'
+		 * are rewritten, so the pieces of a signal are added left to right in linear time.
+		 */
+		void add(const RunLengthCoverage& other,size_t offset) {
+			if(offset>=n) {
+				push(offset-n,0);
+				for(size_t r=0;r< other.runs();r++) push(other.runLength(r),other.depths[r]);
+				return;
+				}
+			// detach the runs from 'offset'
+			size_t r = runAt(offset);
+			std::vector<uint32_t> tail_starts(starts.begin()+r,starts.end());
+			std::vector<int> tail_depths(depths.begin()+r,depths.end());
+			const size_t tail_end = n;
+			tail_starts[0] = (uint32_t)offset;
+			// the run containing 'offset' is kept up to 'offset'
+			if(starts[r]< offset) r++;
+			starts.resize(r);
+			depths.resize(r);
+			n = offset;
+			// merge the two lists of runs
+			const size_t end = std::max(tail_end,offset+other.n);
+			size_t a=0,b=0,pos=offset;
+			while(pos< end) {
+				while(a< tail_depths.size() && (a+1< tail_starts.size()?tail_starts[a+1]:tail_end)<=pos) a++;
+				while(b< other.runs() && offset+other.runEnd(b)<=pos) b++;
+				size_t next = end;
+				int d = 0;
+				if(a< tail_depths.size()) {
+					next = std::min(next,(size_t)(a+1< tail_starts.size()?tail_starts[a+1]:tail_end));
+					d += tail_depths[a];
+					}
+				if(b< other.runs()) {
+					next = std::min(next,offset+other.runEnd(b));
+					d += other.depths[b];
+					}
+				push(next-pos,d);
+				pos = next;
+				}
+			}
+		/** same as binMinMeanMax over the decoded values, any output may be NULL */
+		void bin(size_t n_bins,float* out_min,float* out_mean,float* out_max) const {
+			if(n==0) return;
+			size_t r=0;
+			for(size_t i=0;i< n_bins;i++) {
+				size_t g1 = (size_t)(((uint64_t)i*n)/n_bins);
+				size_t g2 = (size_t)(((uint64_t)(i+1)*n)/n_bins);
+				if(g1>=n) g1=n-1;
+				if(g2<=g1) g2=g1+1;
+				while(runEnd(r)<=g1) r++;
+				int mn = INT_MAX, mx = INT_MIN;
+				int64_t sum = 0;
+				for(size_t k=r;k< depths.size() && starts[k]< g2;k++) {
+					size_t len = std::min(g2,runEnd(k)) - std::max(g1,(size_t)starts[k]);
+					mn = std::min(mn,depths[k]);
+					mx = std::max(mx,depths[k]);
+					sum += (int64_t)depths[k]*(int64_t)len;
+					}
+				if(out_min!=NULL) out_min[i] = (float)mn;
+				if(out_mean!=NULL) out_mean[i] = (float)(sum/(double)(g2-g1));
+				if(out_max!=NULL) out_max[i] = (float)mx;
+				}
+			}
+		/** mean of each bin (same bins as bin()) after a sliding window mean of the values in [i-w,i+w), clipped to the signal.
+		 * A bin gets the sum of the windows of its bases divided by the sum of their sizes, which is the mean of the windows
+		 * but near the ends of the signal, where the windows are truncated. Computed from the prefix sums at the start of the runs.
+		 */
+		void binSmoothed(size_t n_bins,size_t w,float* out_mean) const {
+			if(n==0) return;
+			// S(x) = sum of the values before x, SS(x) = sum of S(i) for i < x
+			std::vector<int64_t> S(depths.size());
+			std::vector<double> SS(depths.size());
+			int64_t s = 0;
+			double ss = 0.0;
+			for(size_t r=0;r< depths.size();r++) {
+				S[r] = s;
+				SS[r] = ss;
+				const double len = (double)runLength(r);
+				ss += len*(double)s + (double)depths[r]*len*(len-1.0)/2.0;
+				s += (int64_t)depths[r]*(int64_t)runLength(r);
+				}
+			const int64_t total = s;
+			const int64_t N = (int64_t)n, W = (int64_t)w;
+			// SS(x): the prefix sums are constant after N
+			auto prefix2 = [&](int64_t x) -> double {
+				if(x<=0) return 0.0;
+				double extra = 0.0;
+				if(x>N) {
+					extra = (double)(x-N)*(double)total;
+					x = N;
+					}
+				size_t r = runAt((size_t)x);
+				const double k = (double)(x-(int64_t)starts[r]);
+				return SS[r] + k*(double)S[r] + (double)depths[r]*k*(k-1.0)/2.0 + extra;
+				};
+			for(size_t i=0;i< n_bins;i++) {
+				int64_t g1 = (int64_t)(((uint64_t)i*n)/n_bins);
+				int64_t g2 = (int64_t)(((uint64_t)(i+1)*n)/n_bins);
+				if(g1>=N) g1=N-1;
+				if(g2<=g1) g2=g1+1;
+				// the window ends at i+W for i < c, at N after
+				const int64_t c = std::max(g1,std::min(g2,N-W+1));
+				double sum = prefix2(c+W) - prefix2(g1+W) + (double)(g2-c)*(double)total;
+				double size = (double)(c-g1)*(double)(g1+c-1+2*W)/2.0 + (double)(g2-c)*(double)N;
+				// the window starts at i-W for i >= c1, at 0 before
+				const int64_t c1 = std::max(g1,std::min(g2,W));
+				sum -= prefix2(g2-W) - prefix2(c1-W);
+				size -= (double)(g2-c1)*(double)(c1+g2-1-2*W)/2.0;
+				out_mean[i] = (float)(size>0.0?sum/size:0.0);
+				}
+			}
+	};
+
+#endif
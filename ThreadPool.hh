@@ -0,0 +1,92 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2019 Pierre Lindenbaum PhD.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <cstddef>
+
+/** runs a fixed list of tasks on 'size()' threads, the calling thread being thread 0.
+ * Each thread starts with a contiguous block of tasks, taken from the front of its own queue; a thread
+ * whose queue is empty steals from the back of the queue of another thread.
+ */
+class WorkStealingPool
+	{
+	private:
+		struct Queue
+			{
+			std::mutex lock;
+			std::deque<size_t> tasks;
+			};
+		int n_threads;
+
+		static bool pop(Queue& q,size_t* task) {
+			std::lock_guard<std::mutex> guard(q.lock);
+			if(q.tasks.empty()) return false;
+			*task = q.tasks.front();
+			q.tasks.pop_front();
+			return true;
+			}
+		static bool steal(std::vector<Queue>& queues,int thief,size_t* task) {
+			for(size_t i=1;i< queues.size();i++) {
+				Queue& q = queues[(thief+i)%queues.size()];
+				std::lock_guard<std::mutex> guard(q.lock);
+				if(q.tasks.empty()) continue;
+				*task = q.tasks.back();
+				q.tasks.pop_back();
+				return true;
+				}
+			return false;
+			}
+	public:
+		WorkStealingPool(int n_threads):n_threads(std::max(1,n_threads)) {
+			}
+		int size() const {
+			return n_threads;
+			}
+		/** call fn(task,thread) for each task in [0,n_tasks), 'thread' being in [0,size()). Return when all the tasks are done */
+		template<typename F>
+		void run(size_t n_tasks,F fn) {
+			if(n_tasks==0) return;
+			const int n = (int)std::min((size_t)n_threads,n_tasks);
+			std::vector<Queue> queues(n);
+			for(int t=0;t< n;t++) {
+				for(size_t i=(t*n_tasks)/n;i< ((t+1)*n_tasks)/n;i++) queues[t].tasks.push_back(i);
+				}
+			auto loop = [&queues,&fn](int t) {
+				size_t task;
+				while(pop(queues[t],&task) || steal(queues,t,&task)) fn(task,t);
+				};
+			std::vector<std::thread> threads;
+			for(int t=1;t< n;t++) threads.push_back(std::thread(loop,t));
+			loop(0);
+			for(auto& t: threads) t.join();
+			}
+	};
+
+#endif
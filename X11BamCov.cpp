@@ -27,7 +27,7 @@ THE SOFTWARE.
 #include <X11/Xutil.h>
 #include <iostream>
 #include <vector>
-#include <iostream>
+#include <algorithm>
 #include <stdexcept>
 #include <fstream>
 #include <sstream>
@@ -36,18 +36,46 @@ THE SOFTWARE.
 #include <unistd.h>
 #include <getopt.h>
 #include <cerrno>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <deque>
+#include <atomic>
+#include <condition_variable>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/select.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #include <htslib/sam.h>
+#include <htslib/bgzf.h>
+#include <htslib/tbx.h>
 #include <htslib/faidx.h>
 #include <htslib/kstring.h>
 #include <htslib/khash_str2int.h>
 
 #include "Palette.hh"
 #include "Hershey.hh"
+#include "CoverageMatrix.hh"
+#include "Binning.hh"
+#include "RunLength.hh"
+#include "CoverageCache.hh"
+#include "ReadAhead.hh"
+#include "GCContent.hh"
+#include "ThreadPool.hh"
 
 using namespace std;
 
 class BamW;
+class SocketStream;
 
 #define THROW_INVALID_ARG(a) do {\
 	cerr << a << endl;\
@@ -66,6 +94,13 @@ static int parseInt(const char* s) {
 	return (int)i;
 	}
 
+/** convert flags, as a number or names like 'PROPER_PAIR,DUP', to int */
+static int parseFlags(const char* s) {
+	int flags = ::bam_str2flag(s);
+	if(flags<0) THROW_INVALID_ARG("Bad flags \"" << s << "\".");
+	return flags;
+	}
+
 /** convert int to string with comma sep */
 static string niceInt(int i) {
 	ostringstream os;
@@ -87,6 +122,85 @@ static bool starts_with(std::string s1,const char* s2) {
 	return s1.compare(0,len2, s2) == 0;
 	}
 
+/** return true if s1 ends with s2 */
+static bool ends_with(const char* s1,const char* s2) {
+	size_t len1=strlen(s1);
+	size_t len2=strlen(s2);
+	if(len2> len1) return false;
+	return strcmp(&s1[len1-len2],s2) == 0;
+	}
+
+/** convert the characters in [p,e) to int without copying */
+static int parseInt(const char* p,const char* e) {
+	const char* p0 = p;
+	bool neg = false;
+	if(p<e && (*p=='-' || *p=='+')) { neg = (*p=='-'); p++; }
+	if(p==e) THROW_INVALID_ARG("Bad number \"" << string(p0,e) << "\". Cannot convert to integer.");
+	long int i = 0;
+	for(;p<e;++p) {
+		if(*p<'0' || *p>'9') THROW_INVALID_ARG("Bad number \"" << string(p0,e) << "\". Cannot convert to integer.");
+		i = i*10 + (*p-'0');
+		if(i>INT_MAX) THROW_INVALID_ARG("Bad number \"" << string(p0,e) << "\". Integer overflow.");
+		}
+	return (int)(neg?-i:i);
+	}
+
+/** fields of an interval, pointing into the parsed line */
+struct IntervalFields
+	{
+	const char* chrom;
+	size_t chrom_len;
+	/* start, 1-based */
+	int start;
+	/* end, 1-based */
+	int end;
+	const char* label;
+	size_t label_len;
+	};
+
+/** parse 'chrom:start-end label' or 'chrom(tab)start0(tab)end(tab)label' in [line,line_end) without copying */
+static void parseInterval(const char* line,const char* line_end,IntervalFields* f) {
+	const char* tab = (const char*)memchr(line,'\t',line_end-line);
+	const char* colon = (const char*)memchr(line,':',line_end-line);
+	const char* p3;
+	if(colon!=NULL && (tab==NULL || tab > colon) ) {
+		const char* p2 = (const char*)memchr(colon+1,'-',line_end-(colon+1));
+		if(p2==NULL) THROW_INVALID_ARG("cannot find hyphen in " << string(line,line_end));
+		p3 = p2+1;
+		while(p3<line_end && *p3!=' ' && *p3!='\t') p3++;
+		f->chrom = line;
+		f->chrom_len = colon-line;
+		f->start = parseInt(colon+1,p2);
+		f->end = parseInt(p2+1,p3);
+		}
+	else if(tab!=NULL)
+		{
+		const char* p2 = (const char*)memchr(tab+1,'\t',line_end-(tab+1));
+		if(p2==NULL) THROW_INVALID_ARG( "cannot find second tab in " << string(line,line_end)) ;
+		p3 = (const char*)memchr(p2+1,'\t',line_end-(p2+1));
+		if(p3==NULL) p3=line_end;
+		f->chrom = line;
+		f->chrom_len = tab-line;
+		f->start = 1 + parseInt(tab+1,p2);
+		f->end = parseInt(p2+1,p3);
+		}
+	else
+		{
+		THROW_INVALID_ARG("Bad interval " << string(line,line_end));
+		}
+	if(f->chrom_len==0) THROW_INVALID_ARG("Empty chrom in " << string(line,line_end));
+	if(f->start >= f->end) THROW_INVALID_ARG("Empty/negative interval " << string(line,line_end));
+	if(p3<line_end) {
+		f->label = p3+1;
+		f->label_len = line_end-(p3+1);
+		}
+	else
+		{
+		f->label = line_end;
+		f->label_len = 0;
+		}
+	}
+
 /** an interval */
 class ChromStartEnd
 	{
@@ -103,54 +217,499 @@ public:
 	int original_start;
 	/* end, before extending */
 	int original_end;
+	/* index of chrom in the contigs of the RegionSource, or -1 */
+	int tid;
+	ChromStartEnd():start(0),end(0),original_start(0),original_end(0),tid(-1) {
+		}
 	/** constructor: accept bed or interval */
-	ChromStartEnd(std::string line):label("") {
-		std::string::size_type tab = line.find('\t');
-		std::string::size_type colon = line.find(':');
-		std::string::size_type p3;
-		if(colon!=string::npos && (tab==string::npos || tab > colon) ) {
-			std::string::size_type p1 = colon;
-			if(p1==string::npos) THROW_INVALID_ARG("cannot find first tab or colon in " << line) ;			
-			std::string::size_type p2 = line.find('-',p1+1);
-			if(p2==string::npos) THROW_INVALID_ARG("cannot find hyphen in " << line);
-			p3 = line.find_first_of(" \t",p2+1);
-			if(p3==string::npos) p3=line.length();
-
-			this->chrom.assign(line.substr(0,p1));
-			this->start= parseInt(line.substr(p1+1,p2-(p1+1)).c_str());
-			this->end= parseInt(line.substr(p2+1,(p3-(p2+1))).c_str());
-			
-
-			}
-		else if(tab!=string::npos)
+	ChromStartEnd(std::string line):label(""),tid(-1) {
+		IntervalFields f;
+		parseInterval(line.c_str(),line.c_str()+line.size(),&f);
+		this->chrom.assign(f.chrom,f.chrom_len);
+		this->start = f.start;
+		this->end = f.end;
+		this->label.assign(f.label,f.label_len);
+		this->original_start = this->start;
+		this->original_end = this->end;
+		}
+	int length() const {
+		return 1+ (this->end - this->start);		
+		}
+	/** extend the interval around its middle by this factor */
+	void extend(float extend_factor) {
+		if(extend_factor == 0.0) return;
+		int L = this->length();
+		int L2 = (int)(L*(1.0+extend_factor));
+		int mid = this->start + L/2;
+		this->start = std::max(1,mid - L2);
+		this->end = mid + L2;
+		}
+	};
+
+/** a list of intervals, accessed by index in the order of the input file */
+class RegionSource
+	{
+public:
+	virtual ~RegionSource() {}
+	/** number of intervals */
+	virtual size_t size()=0;
+	/** get the idx-th interval. The pointer is owned by the source and is only valid until the next call to get/find */
+	virtual ChromStartEnd* get(size_t idx)=0;
+	/** find the index of the first interval overlapping or following chrom:pos on the same contig. Return false if there is none */
+	virtual bool find(const char* chrom,int pos,size_t* idx)=0;
+	/** all the contigs of the source. ChromStartEnd::tid is an index in this vector */
+	virtual const std::vector<std::string>& getContigs()=0;
+	};
+
+/** all intervals of a plain text file, loaded in one contiguous table.
+ * Contig names are interned and labels are stored in a single arena. The file is
+ * memory-mapped and parsed in place.
+ */
+class RegionTable : public RegionSource
+	{
+private:
+	struct Record
+		{
+		int32_t tid;
+		int32_t start;
+		int32_t end;
+		uint32_t label_offset;
+		uint32_t label_length;
+		};
+	float extend_factor;
+	std::vector<Record> records;
+	std::vector<std::string> contigs;
+	/** contig name to tid */
+	void* contig2tid;
+	std::vector<char> labels;
+	/** the interval returned by get() */
+	ChromStartEnd current;
+
+	int internContig(const char* s,size_t len) {
+		// lines are usually grouped by contig: try the previous one first
+		if(!records.empty()) {
+			const string& prev = contigs[records.back().tid];
+			if(prev.size()==len && memcmp(prev.data(),s,len)==0) return records.back().tid;
+			}
+		string name(s,len);
+		int tid;
+		if(::khash_str2int_get(contig2tid,name.c_str(),&tid)==0) return tid;
+		tid = (int)contigs.size();
+		contigs.push_back(name);
+		::khash_str2int_set(contig2tid,::strdup(name.c_str()),tid);
+		return tid;
+		}
+	void parse(const char* p,const char* end) {
+		while(p < end) {
+			const char* eol = (const char*)memchr(p,'\n',end-p);
+			if(eol==NULL) eol = end;
+			const char* line_end = eol;
+			if(line_end>p && line_end[-1]=='\r') line_end--;
+			if(line_end>p && p[0]!='#') {
+				IntervalFields f;
+				parseInterval(p,line_end,&f);
+				Record rec;
+				rec.tid = internContig(f.chrom,f.chrom_len);
+				rec.start = f.start;
+				rec.end = f.end;
+				if(labels.size() + f.label_len > UINT_MAX) THROW_INVALID_ARG("Too many labels.");
+				rec.label_offset = (uint32_t)labels.size();
+				rec.label_length = (uint32_t)f.label_len;
+				labels.insert(labels.end(),f.label,f.label+f.label_len);
+				records.push_back(rec);
+				}
+			p = eol+1;
+			}
+		}
+public:
+	RegionTable(const char* fn,float extend_factor):extend_factor(extend_factor) {
+		contig2tid = ::khash_str2int_init();
+		auto t0 = std::chrono::steady_clock::now();
+		int fd = ::open(fn,O_RDONLY);
+		if(fd<0) THROW_INVALID_ARG("Cannot open " << fn << ". " << ::strerror(errno));
+		struct stat st;
+		if(::fstat(fd,&st)!=0) {
+			::close(fd);
+			THROW_INVALID_ARG("Cannot stat " << fn << ". " << ::strerror(errno));
+			}
+		if(st.st_size>0) {
+			void* mem = ::mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+			if(mem==MAP_FAILED) {
+				::close(fd);
+				THROW_INVALID_ARG("Cannot mmap " << fn << ". " << ::strerror(errno));
+				}
+			::madvise(mem,(size_t)st.st_size,MADV_SEQUENTIAL);
+			try {
+				parse((const char*)mem,(const char*)mem+st.st_size);
+				}
+			catch(...) {
+				::munmap(mem,(size_t)st.st_size);
+				::close(fd);
+				throw;
+				}
+			::munmap(mem,(size_t)st.st_size);
+			}
+		::close(fd);
+		records.shrink_to_fit();
+		labels.shrink_to_fit();
+		auto t1 = std::chrono::steady_clock::now();
+		size_t mem_size = records.capacity()*sizeof(Record) + labels.capacity();
+		for(auto ctg: contigs) mem_size += sizeof(std::string) + ctg.capacity();
+		cerr << "[INFO] loaded " << niceInt((int)records.size()) << " regions on "
+			<< contigs.size() << " contigs from " << fn << " in "
+			<< std::chrono::duration_cast<std::chrono::milliseconds>(t1-t0).count() << " ms. "
+			<< "Table size: " << niceInt((int)(mem_size/1024)) << " Kb." << endl;
+		}
+	virtual ~RegionTable() {
+		::khash_str2int_destroy_free(contig2tid);
+		}
+	virtual size_t size() {
+		return records.size();
+		}
+	virtual ChromStartEnd* get(size_t idx) {
+		const Record& rec = records[idx];
+		current.chrom.assign(contigs[rec.tid]);
+		current.label.assign(labels.data()+rec.label_offset,rec.label_length);
+		current.start = current.original_start = rec.start;
+		current.end = current.original_end = rec.end;
+		current.tid = rec.tid;
+		current.extend(extend_factor);
+		return &current;
+		}
+	virtual const std::vector<std::string>& getContigs() {
+		return contigs;
+		}
+	virtual bool find(const char* chrom,int pos,size_t* idx) {
+		int tid;
+		if(::khash_str2int_get(contig2tid,chrom,&tid)!=0) return false;
+		for(size_t i=0;i< records.size();i++) {
+			const Record& rec = records[i];
+			if(rec.tid!=tid || rec.end < pos) continue;
+			*idx = i;
+			return true;
+			}
+		return false;
+		}
+	};
+
+/** intervals read on demand from a bgzipped, tabix-indexed bed file.
+ * The number of intervals per contig comes from the index; only one block of
+ * BLOCK_SIZE intervals is kept in memory. The virtual offset of every BLOCK_SIZE-th
+ * line of a contig is remembered the first time the contig is scanned, so a block can
+ * later be reloaded with a single seek.
+ */
+class TabixRegionSource : public RegionSource
+	{
+private:
+	static const size_t BLOCK_SIZE = 1024;
+	htsFile* fp;
+	tbx_t* tbx;
+	float extend_factor;
+	std::vector<std::string> contigs;
+	/** index of the first interval of each contig, plus the total count */
+	std::vector<size_t> first_idx;
+	/** per contig: virtual offset of lines 0, BLOCK_SIZE, 2*BLOCK_SIZE... */
+	std::vector<std::vector<int64_t> > checkpoints;
+	/** per contig: virtual offset after the last line */
+	std::vector<int64_t> contig_end;
+	/** current block */
+	int block_tid;
+	size_t block_num;
+	std::vector<ChromStartEnd*> block;
+	kstring_t line;
+
+	void clearBlock() {
+		for(auto iter:block) delete iter;
+		block.clear();
+		block_tid = -1;
+		}
+	/** scan the lines of 'tid' until the checkpoint 'n' or the virtual offset 'until' is known */
+	void scan(int tid,size_t n,int64_t until) {
+		std::vector<int64_t>& cp = this->checkpoints[tid];
+		if(cp.empty()) {
+			hts_itr_t* itr = tbx_itr_queryi(this->tbx,tid,0,INT_MAX);
+			if(itr==NULL || itr->n_off==0) THROW_INVALID_ARG("Cannot query " << contigs[tid] << " in tabix index.");
+			int64_t off = (int64_t)itr->off[0].u;
+			for(int i=1;i< itr->n_off;i++) off = std::min(off,(int64_t)itr->off[i].u);
+			tbx_itr_destroy(itr);
+			cp.push_back(off);
+			}
+		if(contig_end[tid]>=0 || (cp.size()>n && cp.back()>=until)) return;
+		BGZF* bgzf = hts_get_bgzfp(this->fp);
+		size_t count = (cp.size()-1)*BLOCK_SIZE;
+		size_t n_lines = first_idx[tid+1]-first_idx[tid];
+		if(bgzf_seek(bgzf,cp.back(),SEEK_SET)<0) THROW_INVALID_ARG("Cannot seek in tabix file.");
+		while(cp.size()<=n || bgzf_tell(bgzf) < until) {
+			if(count>=n_lines) {
+				contig_end[tid] = bgzf_tell(bgzf);
+				break;
+				}
+			if(bgzf_getline(bgzf,'\n',&line)<0) THROW_INVALID_ARG("Unexpected end of tabix file in " << contigs[tid]);
+			count++;
+			if(count%BLOCK_SIZE==0) cp.push_back(bgzf_tell(bgzf));
+			}
+		}
+	void loadBlock(int tid,size_t b) {
+		if(tid==this->block_tid && b==this->block_num) return;
+		clearBlock();
+		scan(tid,b,-1);
+		size_t n_lines = first_idx[tid+1]-first_idx[tid];
+		BGZF* bgzf = hts_get_bgzfp(this->fp);
+		if(bgzf_seek(bgzf,checkpoints[tid][b],SEEK_SET)<0) THROW_INVALID_ARG("Cannot seek in tabix file.");
+		for(size_t i= b*BLOCK_SIZE;i < n_lines && block.size() < BLOCK_SIZE; i++) {
+			if(bgzf_getline(bgzf,'\n',&line)<0) THROW_INVALID_ARG("Unexpected end of tabix file in " << contigs[tid]);
+			ChromStartEnd* rgn = new ChromStartEnd(line.s);
+			rgn->tid = tid;
+			rgn->extend(extend_factor);
+			block.push_back(rgn);
+			}
+		this->block_tid = tid;
+		this->block_num = b;
+		}
+public:
+	TabixRegionSource(const char* fn,float extend_factor):fp(NULL),tbx(NULL),extend_factor(extend_factor),block_tid(-1),block_num(0) {
+		line.l = line.m = 0; line.s = NULL;
+		fp = ::hts_open(fn,"r");
+		if(fp==NULL) THROW_INVALID_ARG("Cannot open " << fn << ". " << ::strerror(errno));
+		tbx = ::tbx_index_load(fn);
+		if(tbx==NULL) THROW_INVALID_ARG("Cannot load tabix index for " << fn);
+		int n_seqs = 0;
+		const char** names = ::tbx_seqnames(tbx,&n_seqs);
+		size_t total = 0;
+		for(int i=0;i< n_seqs;i++) {
+			uint64_t mapped=0,unmapped=0;
+			if(::hts_idx_get_stat(tbx->idx,i,&mapped,&unmapped)<0) {
+				free(names);
+				THROW_INVALID_ARG("No record count in the tabix index of " << fn << ". Re-index the file with a recent tabix.");
+				}
+			contigs.push_back(names[i]);
+			first_idx.push_back(total);
+			total+=(size_t)mapped;
+			}
+		free(names);
+		first_idx.push_back(total);
+		checkpoints.resize(contigs.size());
+		contig_end.resize(contigs.size(),-1);
+		}
+	virtual ~TabixRegionSource() {
+		clearBlock();
+		free(line.s);
+		if(tbx!=NULL) ::tbx_destroy(tbx);
+		if(fp!=NULL) ::hts_close(fp);
+		}
+	virtual size_t size() {
+		return first_idx.back();
+		}
+	virtual ChromStartEnd* get(size_t idx) {
+		int tid = (int)(std::upper_bound(first_idx.begin(),first_idx.end(),idx) - first_idx.begin()) - 1;
+		size_t k = idx - first_idx[tid];
+		loadBlock(tid,k/BLOCK_SIZE);
+		return block[k%BLOCK_SIZE];
+		}
+	virtual bool find(const char* chrom,int pos,size_t* idx) {
+		int tid = ::tbx_name2id(this->tbx,chrom);
+		if(tid<0) return false;
+		// first line overlapping or after 'pos', in file order
+		hts_itr_t* itr = tbx_itr_queryi(this->tbx,tid,std::max(0,pos-1),INT_MAX);
+		if(itr==NULL) return false;
+		int ret = tbx_itr_next(this->fp,this->tbx,itr,&line);
+		int64_t after = (int64_t)itr->curr_off;
+		tbx_itr_destroy(itr);
+		if(ret<0) return false;
+		// convert the virtual offset to a line number using the checkpoints
+		scan(tid,0,after);
+		std::vector<int64_t>& cp = this->checkpoints[tid];
+		size_t b = (size_t)(std::upper_bound(cp.begin(),cp.end(),after-1) - cp.begin()) - 1;
+		BGZF* bgzf = hts_get_bgzfp(this->fp);
+		if(bgzf_seek(bgzf,cp[b],SEEK_SET)<0) THROW_INVALID_ARG("Cannot seek in tabix file.");
+		size_t k = b*BLOCK_SIZE;
+		for(;;) {
+			if(bgzf_getline(bgzf,'\n',&line)<0) return false;
+			if(bgzf_tell(bgzf) >= after) break;
+			k++;
+			}
+		clearBlock();
+		*idx = first_idx[tid] + k;
+		return true;
+		}
+	virtual const std::vector<std::string>& getContigs() {
+		return contigs;
+		}
+	};
+
+
+/** a bam header shared by all the bams having the same sequence dictionary */
+class SharedHeader
+	{
+public:
+	bam_hdr_t* hdr;
+	/** hash of the names and lengths of the sequences */
+	uint64_t signature;
+	/** contig index in the RegionSource to tid in this header, or -1 */
+	std::vector<int> region2tid;
+
+	SharedHeader(bam_hdr_t* hdr):hdr(hdr),signature(SharedHeader::hash(hdr)) {
+		// build the name dictionary now: bam_name2id creates it on first use, which is not thread-safe
+		::bam_name2id(hdr,"");
+		}
+	~SharedHeader() {
+		::bam_hdr_destroy(hdr);
+		}
+	/** FNV-1a hash of the sequence dictionary */
+	static uint64_t hash(const bam_hdr_t* h) {
+		uint64_t x = 14695981039346656037ULL;
+		for(int i=0;i< h->n_targets;i++) {
+			for(const char* p=h->target_name[i];;p++) {
+				x = (x ^ (unsigned char)*p) * 1099511628211ULL;
+				if(*p==0) break;
+				}
+			x = (x ^ h->target_len[i]) * 1099511628211ULL;
+			}
+		return x;
+		}
+	/** true if 'h', whose hash is 'sig', has the same sequence dictionary */
+	bool same(const bam_hdr_t* h,uint64_t sig) {
+		if(sig!=signature || h->n_targets!=hdr->n_targets) return false;
+		for(int i=0;i< h->n_targets;i++) {
+			if(h->target_len[i]!=hdr->target_len[i] || strcmp(h->target_name[i],hdr->target_name[i])!=0) return false;
+			}
+		return true;
+		}
+	/** tid of the contig 'ctg', allowing the 'chr' prefix to be added or removed. -1 if not found */
+	int nameToTid(const std::string& ctg) {
+		int tid = ::bam_name2id(hdr, ctg.c_str());
+		if(tid<0 && starts_with(ctg,"chr"))
 			{
-			std::string::size_type p1 = tab;
-			std::string::size_type p2 = line.find('\t',p1+1);
-			if(p2==string::npos) THROW_INVALID_ARG( "cannot find second tab in " << line) ;
-			std::string::size_type p3 = line.find('\t',p2+1);
-			if(p3==string::npos) p3=line.length();
-			this->chrom.assign(line.substr(0,p1));
-			this->start= 1 + parseInt(line.substr(p1+1,p2-(p1+1)).c_str());
-			this->end= parseInt(line.substr(p2+1,(p3-(p2+1))).c_str());
+			string ctg2 = ctg.substr(3);
+			tid = ::bam_name2id(hdr, ctg2.c_str());
 			}
-		else
+		if(tid<0 && !starts_with(ctg,"chr"))
 			{
-			THROW_INVALID_ARG("Bad interval " << line);	
+			string ctg2 = "chr";
+			ctg2.append(ctg);
+			tid = ::bam_name2id(hdr, ctg2.c_str());
 			}
-		if(this->chrom.empty()) THROW_INVALID_ARG("Empty chrom in " << line);
-		if(this->start >= this->end) THROW_INVALID_ARG("Empty/negative interval " << line);		
-		if(p3<line.size()) {
-			this->label.assign(line.substr(p3+1));			
+		return tid;
+		}
+	/** build region2tid */
+	void mapContigs(const std::vector<std::string>& contigs) {
+		region2tid.clear();
+		for(auto ctg: contigs) {
+			region2tid.push_back(nameToTid(ctg));
 			}
-		this->original_start = this->start;
-		this->original_end = this->end;
 		}
-	int length() {
-		return 1+ (this->end - this->start);		
+	};
+
+/** the base-level signals of one bam over one region, see X11BamCov::loadSignals(std::vector<SignalJob>&) */
+struct SignalJob
+	{
+	size_t bam_idx;
+	int tid;
+	const ChromStartEnd* rgn;
+	/** number of columns of the drawing, used by the saturating count, see Saturation */
+	int n_bins;
+	std::vector<RunLengthCoverage> signals;
+	};
+
+/** the reads and the bases counted in the signals, see BamW::fetchSamples */
+struct ReadFilter
+	{
+	/** reads having any of these flags are skipped */
+	int exclude_flags;
+	/** reads not having all of these flags are skipped */
+	int require_flags;
+	/** reads with a lower MAPQ are skipped */
+	int min_mapq;
+	/** aligned bases with a lower base quality are not counted in the depth. 0: all the bases */
+	int min_base_qual;
+
+	ReadFilter():exclude_flags(BAM_FUNMAP | BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP),require_flags(0),min_mapq(0),min_base_qual(0) {
+		}
+	bool accept(const bam1_core_t* c) const {
+		return (c->flag & exclude_flags)==0 && (c->flag & require_flags)==require_flags && c->qual >= min_mapq;
+		}
+	};
+
+/** the saturating count (X11BamCov::saturate_depth) of the samples of a file over a region drawn in 'n_bins' columns
+ * like binMinMeanMax. A read is skipped when every column it overlaps has reached the cap in the depth of its strand
+ * and, for a poorly mapped read, in the low MAPQ depth; the total depth is at least the depth of a strand. All the bases
+ * of such a column are above the cap, and binSignals caps each base before the binning and the smoothing, so the
+ * drawing is unchanged. The clips of the skipped reads are still counted. The state is carried from chunk to chunk,
+ * so the chunks of the region must be read in order, see BamW::fetchSamples.
+ */
+struct Saturation
+	{
+	int cap;
+	/** offset in the region of the first base of each column, then the length of the region */
+	std::vector<int> col_starts;
+	/** for each sample, the signals of the next chunk counted by the reads of the previous chunks, from its first base */
+	std::vector<std::vector<std::vector<int> > > carry;
+	/** for each sample and each of the forward, reverse and low MAPQ depths: offset in the region of the first base,
+	 * from the column of the current read, below the cap
+	 */
+	std::vector<int> frontiers;
+
+	Saturation(int cap,int length,int n_bins,size_t n_samples):cap(cap),carry(n_samples),frontiers(3*n_samples,0) {
+		for(int i=0;i< n_bins;i++) {
+			int g1 = (int)(((int64_t)i*length)/n_bins);
+			if(col_starts.empty() || g1>col_starts.back()) col_starts.push_back(g1);
+			}
+		col_starts.push_back(length);
+		}
+	/** offset of the first base of the column of 'offset' */
+	int columnStart(int offset) const {
+		return *(std::upper_bound(col_starts.begin(),col_starts.end()-1,offset)-1);
+		}
+	/** offset after the last base of the column of 'offset' */
+	int columnEnd(int offset) const {
+		return *std::upper_bound(col_starts.begin(),col_starts.end()-1,offset);
 		}
+	};
+
+/** max number of files read by a batch of jobs, see X11BamCov::batchByFile */
+#define MAX_JOB_FILES 16
+/** the handles of a thread of X11BamCov::pool on the files, kept open from one loadSignals to the next. At most
+ * MAX_JOB_FILES of them are open, the least recently used being closed first, so a batch of jobs fits.
+ */
+struct ThreadHandles
+	{
+	/** most recently used first */
+	std::list<std::pair<BamW*,samFile*> > lru;
+	bam1_t* b;
+	ThreadHandles():b(NULL) {
+		}
+	samFile* get(BamW* file);
+	void close();
+	};
+
+#define APPROX_OFF 0
+#define APPROX_CHROM 1
+#define APPROX_GENOME 2
+#define NUM_APPROX_MODES 3
+/** a contig of the approximate view, drawn in 'n_cols' columns from 'col0' */
+struct ApproxSegment
+	{
+	std::string chrom;
+	int length;
+	int col0;
+	int n_cols;
+	};
 
+/** mean depth of each bam over a region in THUMB_BINS columns, see X11BamCov::computeThumbnail */
+struct Thumbnail
+	{
+	std::vector<float> values;
+	/** value of X11BamCov::thumb_clock when it was last drawn or computed: the least recently used is evicted first */
+	uint64_t last_use;
 	};
 
+/** an action of a script, see option -L */
+struct ScriptAction
+	{
+	long long ms;
+	std::string key;
+	std::string arg;
+	};
 
 class X11BamCov
 	{
@@ -160,7 +719,9 @@ public:
 	int screen_number;
 	Window window;
 	std::vector<BamW*> bams;
-	std::vector<ChromStartEnd*> regions;
+	/** distinct sequence dictionaries of the bams */
+	std::vector<SharedHeader*> headers;
+	RegionSource* regions;
 	size_t region_idx;
 	int window_width;
 	int window_height;
@@ -170,16 +731,176 @@ public:
 	Palette* palette;
 	int cap_depth;
 	bool show_sample_name;
+	/** show the min/max envelope of the depth */
+	bool show_envelope;
 	int smooth_factor;
+	/** on-disk cache of base-level coverage, or NULL */
+	CoverageCache* cache;
+	/** connection to a coverage server ('x11hts serve'), or NULL */
+	SocketStream* server;
+	/** what is drawn in each panel: one of TRACK_* */
+	int track_mode;
+	/** which signal is drawn: one of SIGNAL_* */
+	int signal;
+	/** reads with a MAPQ below this value are counted in SIGNAL_LOW_MAPQ */
+	int low_mapq;
+	/** the reads counted in the signals */
+	ReadFilter filter;
+	/** regions longer than this are first drawn from a sample of the reads, then refined. 0: never */
+	int preview_length;
+	/** some panels still show the preview */
+	bool refining;
+	/** skip the reads whose columns all reached cap_depth, see Saturation and BamW::fetchSamples */
+	bool saturate_depth;
+	/** the regions of a bam closer than this distance are read at once, see loadSignals. -1: never */
+	int merge_distance;
+	/** prefetch the compressed blocks of each query and read the bams by blocks of this size (KB), see ReadAhead. 0: only report the I/O, -1: off */
+	int readahead_kb;
+	/** I/O counters of the process when the bams are opened */
+	IOCounters io_start;
+	/** indexed reference of the bams, or NULL */
+	faidx_t* reference;
+	/** GC fraction of each bin of the current region, empty without reference. See gcContent */
+	std::vector<float> gc_content;
+	/** GC fraction of the bins of the regions already seen, the key is the region and the number of bins */
+	std::map<std::string,std::vector<float> > gc_cache;
+	/** show the depth corrected for the GC content */
+	bool gc_correction;
+	/** the binned depth corrected for the GC content */
+	CoverageMatrix gc_corrected;
+	/** threads reading the bams */
+	WorkStealingPool pool;
+	/** for each thread of 'pool', its handles on the files, used by one loadSignals at a time */
+	std::vector<ThreadHandles> pool_handles;
+	/** draw the density of the reads from the indexes only: one of APPROX_* */
+	int approx_mode;
+	std::vector<ApproxSegment> approx_segments;
+	/** density of each column of the approximate view, relative to the mean of the bam */
+	CoverageMatrix approx;
+	/** mode, contig and number of columns of 'approx' */
+	std::string approx_key;
+	/** output of the key 'S', or NULL */
+	FILE* save_out;
+	/** the keys are written in this script, or NULL */
+	FILE* record_out;
+	/** time of the first paint */
+	std::chrono::steady_clock::time_point session_start;
+	/** keyPending() is true after this time, used when replaying a script */
+	std::chrono::steady_clock::time_point deadline;
+	bool has_deadline;
+	/** milliseconds from the key press to its first drawing (the preview), for each key */
+	std::map<std::string,std::vector<double> > latencies;
+	/** milliseconds from the key press to the end of the refinement, for each key. A refinement interrupted by the next key is not counted */
+	std::map<std::string,std::vector<double> > refined_latencies;
+	/** the last key handled by timedKey, and the time it was pressed */
+	std::string timed_key;
+	std::chrono::steady_clock::time_point timed_received;
+	/** time of the first drawing flushed since timed_key was pressed, see flushPaint */
+	std::chrono::steady_clock::time_point timed_painted;
+	bool has_timed_paint;
+	/** the refinement of timed_key is running */
+	bool timed_refining;
+	/** the key 'G' asked for a position, read from stdin by the main loop, see readPosition */
+	bool goto_prompt;
+	/** characters read from stdin, not yet a full line */
+	std::string stdin_buffer;
+	/** show the grid of the thumbnails of the regions instead of the current region, see paintOverview */
+	bool overview;
+	/** first region and size of the page of the overview */
+	size_t overview_first;
+	int overview_cols;
+	int overview_rows;
+	/** thumbnail of each region index. Filled by the thumbnail thread */
+	std::map<size_t,Thumbnail> thumbnails;
+	/** incremented each time a thumbnail is drawn, see Thumbnail::last_use */
+	uint64_t thumb_clock;
+	/** the regions of the current page of the overview and of the next one, never evicted from 'thumbnails' */
+	size_t thumb_keep_first;
+	size_t thumb_keep_end;
+	/** regions waiting for their thumbnail, the visible ones first */
+	std::deque<std::pair<size_t,ChromStartEnd> > thumb_queue;
+	/** guards thumbnails, thumb_clock, thumb_keep_first, thumb_keep_end, thumb_queue and thumb_stop */
+	std::mutex thumb_lock;
+	std::condition_variable thumb_cond;
+	std::thread thumb_thread;
+	bool thumb_stop;
+	/** the thumbnail thread sent an event that the main loop did not handle yet */
+	std::atomic<bool> thumb_notified;
+	/** binned signals, one matrix per SIGNAL_*, one row per bam */
+	std::vector<CoverageMatrix> binned;
+	/** min and max of the base-level depth of each bin, before smoothing */
+	CoverageMatrix binned_min;
+	CoverageMatrix binned_max;
+	/** ratio or z-score of each bam against the cohort */
+	CoverageMatrix cohort_track;
+	std::vector<float> cohort_median;
+	std::vector<float> cohort_mad;
+	/** 1/spread of each bin of cohort_track, see computeCohortTrack */
+	std::vector<float> cohort_inv_spread;
+	std::vector<float> cohort_scratch;
 	X11BamCov();
 	~X11BamCov();
 	int doWork(int argc,char** argv);
 	void repaint();
 	void paint();
+	void paintBam(GC gc,size_t bam_idx,const ChromStartEnd* rgn,double max_signal);
+	double maxEventSignal() const;
+	bool keyPending();
+	void refine();
+	void loadBinned(const std::vector<size_t>& bam_idxs,const ChromStartEnd* rgn);
+	void sampleSignals(const std::vector<size_t>& bam_idxs,const ChromStartEnd* rgn,int n_bins);
+	void batchByFile(const std::vector<size_t>& bam_idxs,std::vector<std::vector<size_t> >& batches) const;
+	void gcContent(const ChromStartEnd* rgn,int n_bins);
+	void computeGCCorrection();
+	const CoverageMatrix& currentSignal() const;
+	int callCNVs(const char* filename);
+	void indexDensity(int n_bins);
+	int handleKey(unsigned int keycode,std::string& arg);
+	int timedKey(unsigned int keycode,const std::string& name,std::string& arg,std::chrono::steady_clock::time_point received);
+	bool readPosition(std::string& line);
+	bool loadScript(const char* filename,std::vector<ScriptAction>& script);
+	void flushPaint();
+	void printLatencies(std::ostream& out,const char* title,std::map<std::string,std::vector<double> >& table);
+	void printIOStats(std::ostream& out);
+	void paintApprox();
+	void repaintOverview();
+	void paintOverview();
+	void thumbnailLoop();
+	void stopThumbnails();
+	void computeThumbnail(const ChromStartEnd& rgn,ThreadHandles& handles,std::vector<float>& values);
+	bool thumbnailPreview(size_t bam_idx,int n_bins);
 	void resized();
 	void usage(std::ostream& out);
+	bool gotoPosition(const char* s);
+	SharedHeader* shareHeader(bam_hdr_t* h);
+	void computeCohortTrack();
+	void updateCohortRows(const std::vector<size_t>& bam_idxs);
+	std::string cacheKey(const BamW* bam,const ChromStartEnd* rgn,int n_bins) const;
+	void loadSignals(BamW* bam,int tid,const ChromStartEnd* rgn,int n_bins,bam1_t* b,std::vector<RunLengthCoverage>& signals);
+	void loadSignals(std::vector<SignalJob>& jobs);
+	bool loadBams(const char* bam_list);
+	bool connectServer(const char* socket_path);
+	bool fetchRemote(const ChromStartEnd* rgn,int n_bins);
+	void normalizeLibrarySizes();
 	};
 
+#define TRACK_DEPTH 0
+#define TRACK_RATIO 1
+#define TRACK_ZSCORE 2
+#define NUM_TRACK_MODES 3
+
+/* signals extracted from each read, see BamW::fetchSignals */
+#define SIGNAL_DEPTH 0
+#define SIGNAL_FORWARD 1
+#define SIGNAL_REVERSE 2
+#define SIGNAL_LOW_MAPQ 3
+#define SIGNAL_CLIP 4
+#define SIGNAL_SPLIT 5
+#define NUM_SIGNALS 6
+static const char* SIGNAL_NAMES[NUM_SIGNALS]={"depth","forward","reverse","low MAPQ","clipped reads","split reads"};
+/** true for the signals counting reads at one position, rather than a depth */
+#define SIGNAL_IS_EVENT(s) ((s)==SIGNAL_CLIP || (s)==SIGNAL_SPLIT)
+
 
 class BamW
 	{
@@ -187,26 +908,134 @@ class BamW
 		X11BamCov* owner;
 		std::string filename;
 		std::string sample;
-		std::vector<float> coverage;
+		/** number of mapped reads, from the index */
+		uint64_t mapped_reads;
+		/** factor normalizing the depth of this bam to the mean library size of the cohort */
+		float scale;
+		/** identifies this version of the file in the coverage cache: path, size and modification time */
+		std::string cache_id;
+		/** serializes the reads of 'fp' when the bam is shared by several threads */
+		std::mutex lock;
 		samFile *fp;
-		bam_hdr_t *hdr;  // the file header
+		SharedHeader *header;  // the file header, shared with the other bams having the same dictionary
 		hts_idx_t *idx = NULL;
 		bool bad_flag;
+		/** the binned signals are a preview, see X11BamCov::sampleSignals */
+		bool approximate;
 		double max_depth;
 		XRectangle bounds;
+		/** the panel owning fp, idx and the read groups of the file: 'this', unless the file holds several samples */
+		BamW* file;
+		/** index of the sample of this panel in file->panels, -1 if the file holds one sample */
+		int rg_sample;
+		/** one panel per sample of the file, in the order of the header. Empty if the file holds one sample */
+		std::vector<BamW*> panels;
+		/** read group ID to index in 'panels', or NULL */
+		void* rg2sample;
+		/** prefetch of the queries of the file, or NULL, see X11BamCov::readahead_kb */
+		ReadAhead* readahead;
 		
 		BamW(X11BamCov* owner,std::string fn);
+		/** a bam opened by a coverage server: only its name is known */
+		BamW(X11BamCov* owner,std::string fn,std::string sample,uint64_t mapped_reads);
+		/** the panel of another sample of 'file' */
+		BamW(BamW* file,int rg_sample,std::string sample);
 		~BamW();
+		bool isRemote() const { return fp==NULL;}
+		samFile* open() const;
+		int sampleOf(const bam1_t* b) const;
+		void fetchSamples(samFile* in,int tid,const ChromStartEnd* rgn,int chunk_start,int chunk_end,bam1_t* b,std::vector<std::vector<std::vector<int> > >& samples,Saturation* saturation);
+		template<bool CAPPED,bool BASE_QUALITY>
+		void fetchSamplesKernel(samFile* in,int tid,const ChromStartEnd* rgn,int chunk_start,int chunk_end,bam1_t* b,std::vector<std::vector<std::vector<int> > >& samples,Saturation* saturation);
+		void fetchSignals(int tid,const ChromStartEnd* rgn,bam1_t* b,std::vector<std::vector<int> >& signals,Saturation* saturation);
+		void fetchSignals(samFile* in,int tid,const ChromStartEnd* rgn,int chunk_start,int chunk_end,bam1_t* b,std::vector<std::vector<int> >& signals,Saturation* saturation);
+		Saturation* newSaturation(int length,int n_bins) const;
+		void sampleWindow(samFile* in,int tid,const ChromStartEnd* rgn,int n_bins,int k,bam1_t* b,std::vector<std::vector<std::vector<int> > >& samples,int* col1,int* col2);
+		int64_t indexOffset(int tid,int pos) const;
+	};
+
+/** buffered reading and writing on a connected socket */
+class SocketStream
+	{
+	private:
+		int fd;
+		char buffer[65536];
+		size_t buffer_pos;
+		size_t buffer_len;
+		bool fill() {
+			if(buffer_pos < buffer_len) return true;
+			ssize_t n;
+			do {
+				n = ::recv(fd,buffer,sizeof(buffer),0);
+				} while(n<0 && errno==EINTR);
+			if(n<=0) return false;
+			buffer_pos = 0;
+			buffer_len = (size_t)n;
+			return true;
+			}
+	public:
+		SocketStream(int fd):fd(fd),buffer_pos(0),buffer_len(0) {
+			}
+		~SocketStream() {
+			::close(fd);
+			}
+		/** read a line, without the trailing newline. Return false at the end of the stream */
+		bool readLine(std::string& line) {
+			line.clear();
+			for(;;) {
+				if(!fill()) return !line.empty();
+				const char* p = buffer+buffer_pos;
+				const char* eol = (const char*)memchr(p,'\n',buffer_len-buffer_pos);
+				if(eol==NULL) {
+					line.append(p,buffer_len-buffer_pos);
+					buffer_pos = buffer_len;
+					continue;
+					}
+				line.append(p,eol-p);
+				buffer_pos += (eol-p)+1;
+				if(!line.empty() && line[line.size()-1]=='\r') line.resize(line.size()-1);
+				return true;
+				}
+			}
+		/** read exactly 'n' bytes */
+		bool read(void* ptr,size_t n) {
+			char* p = (char*)ptr;
+			while(n>0) {
+				if(!fill()) return false;
+				size_t k = std::min(n,buffer_len-buffer_pos);
+				memcpy(p,buffer+buffer_pos,k);
+				buffer_pos+=k;
+				p+=k;
+				n-=k;
+				}
+			return true;
+			}
+		bool write(const void* ptr,size_t n) {
+			const char* p = (const char*)ptr;
+			while(n>0) {
+				ssize_t k = ::send(fd,p,n,MSG_NOSIGNAL);
+				if(k<0 && errno==EINTR) continue;
+				if(k<=0) return false;
+				p+=k;
+				n-=(size_t)k;
+				}
+			return true;
+			}
+		bool write(const std::string& s) {
+			return write(s.data(),s.size());
+			}
 	};
 
-BamW::BamW(X11BamCov* owner,std::string fn):owner(owner),filename(fn),sample(fn) {
+#define READ_GROUP_SAMPLE 100000
+BamW::BamW(X11BamCov* owner,std::string fn):owner(owner),filename(fn),sample(fn),mapped_reads(0),scale(1.0f),file(this),rg_sample(-1),rg2sample(NULL),readahead(NULL) {
 	
-	fp = ::hts_open(fn.c_str(), "r");
+	fp = open();
 	if(fp==NULL) {
 		cerr << "Cannot open " << fn << ". " << ::strerror(errno) << endl;
 		exit(EXIT_FAILURE);
 		}
-	hdr = sam_hdr_read(fp); 
+	if(owner->readahead_kb>0) this->readahead = new ReadAhead(fn,(uint64_t)owner->readahead_kb*1024);
+	bam_hdr_t* hdr = sam_hdr_read(fp); 
 	if (hdr == NULL) {
             cerr << "Cannot open header for " << fn << "." << endl;
             exit(EXIT_FAILURE);
@@ -219,6 +1048,9 @@ BamW::BamW(X11BamCov* owner,std::string fn):owner(owner),filename(fn),sample(fn)
 		}
 
 
+	// (ID, SM) of each read group
+	vector<pair<string,string> > read_groups;
+	vector<string> samples;
 	if(hdr->text!=NULL)
 		{
 		
@@ -232,21 +1064,416 @@ BamW::BamW(X11BamCov* owner,std::string fn):owner(owner),filename(fn),sample(fn)
 			p+=4;
 			string::size_type  p2 = line.find("\t",p);
 			if(p2==string::npos) p2=line.size();
-			sample = line.substr(p,(p2-p));
-			break;
+			string sm = line.substr(p,(p2-p));
+			p = line.find("\tID:");
+			if(p!=string::npos) {
+				p+=4;
+				p2 = line.find("\t",p);
+				if(p2==string::npos) p2=line.size();
+				read_groups.push_back(make_pair(line.substr(p,(p2-p)),sm));
+				}
+			if(std::find(samples.begin(),samples.end(),sm)==samples.end()) samples.push_back(sm);
+			}
+		if(!samples.empty()) sample = samples[0];
+		}
+	{
+		struct stat st;
+		char* path = ::realpath(fn.c_str(),NULL);
+		ostringstream os;
+		os << (path==NULL?fn.c_str():path);
+		if(::stat(fn.c_str(),&st)==0) os << "\t" << st.st_size << "\t" << st.st_mtime;
+		free(path);
+		this->cache_id.assign(os.str());
+	}
+	for(int i=0;i< hdr->n_targets;i++) {
+		uint64_t mapped=0,unmapped=0;
+		if(::hts_idx_get_stat(idx,i,&mapped,&unmapped)<0) break;
+		mapped_reads+=mapped;
+		}
+	if(samples.size()>1) {
+		// one panel per sample, the reads are dispatched by their read group
+		this->rg2sample = ::khash_str2int_init();
+		for(auto& rg: read_groups) {
+			int sample_idx = (int)(std::find(samples.begin(),samples.end(),rg.second)-samples.begin());
+			if(::khash_str2int_has_key(this->rg2sample,rg.first.c_str())) continue;
+			::khash_str2int_set(this->rg2sample,::strdup(rg.first.c_str()),sample_idx);
+			}
+		this->rg_sample = 0;
+		this->panels.push_back(this);
+		for(size_t i=1;i< samples.size();i++) {
+			this->panels.push_back(new BamW(this,(int)i,samples[i]));
+			}
+		// the index only counts the reads of the file: split them like the first READ_GROUP_SAMPLE reads
+		vector<uint64_t> counts(samples.size(),0);
+		uint64_t n_counted = 0;
+		bam1_t* b = ::bam_init1();
+		for(int n_read=0;n_read< READ_GROUP_SAMPLE && ::sam_read1(fp,hdr,b)>=0;n_read++) {
+			if(b->core.flag & BAM_FUNMAP) continue;
+			int sample_idx = sampleOf(b);
+			if(sample_idx< 0) continue;
+			counts[sample_idx]++;
+			n_counted++;
+			}
+		::bam_destroy1(b);
+		const uint64_t file_mapped = this->mapped_reads;
+		for(size_t i=0;i< samples.size();i++) {
+			BamW* panel = this->panels[i];
+			panel->mapped_reads = (n_counted==0?file_mapped/samples.size():(uint64_t)((file_mapped*(double)counts[i])/n_counted));
+			panel->cache_id = this->cache_id + "\tSM:" + samples[i];
+			}
+		cerr << "[INFO] " << fn << ": " << samples.size() << " samples." << endl;
+		}
+	// the text is not needed anymore, only the dictionary is kept
+	free(hdr->text);
+	hdr->text = NULL;
+	hdr->l_text = 0;
+	this->header = owner->shareHeader(hdr);
+	for(size_t i=1;i< this->panels.size();i++) this->panels[i]->header = this->header;
+	this->bad_flag = false;
+	this->approximate = false;
+
+	}
+
+BamW::BamW(BamW* file,int rg_sample,std::string sample):owner(file->owner),filename(file->filename),sample(sample),
+	mapped_reads(0),scale(1.0f),fp(file->fp),header(file->header),idx(file->idx),bad_flag(false),approximate(false),
+	file(file),rg_sample(rg_sample),rg2sample(NULL),readahead(NULL) {
+	}
+
+/** open a handle on the file. With X11BamCov::readahead_kb, BGZF reads it by blocks of that size */
+samFile* BamW::open() const {
+	samFile* in = ::hts_open(this->filename.c_str(),"r");
+	if(in!=NULL && owner->readahead_kb>0) ::hts_set_opt(in,HTS_OPT_BLOCK_SIZE,owner->readahead_kb*1024);
+	return in;
+	}
+
+/** the handle of this thread on 'file', opened if needed. NULL if the file cannot be opened, e.g. no more file descriptors */
+samFile* ThreadHandles::get(BamW* file) {
+	for(auto r=lru.begin();r!=lru.end();++r) {
+		if(r->first!=file) continue;
+		lru.splice(lru.begin(),lru,r);
+		return r->second;
+		}
+	samFile* in = file->open();
+	if(in==NULL) return NULL;
+	if(lru.size()>=MAX_JOB_FILES) {
+		::hts_close(lru.back().second);
+		lru.pop_back();
+		}
+	lru.push_front(make_pair(file,in));
+	return in;
+	}
+
+void ThreadHandles::close() {
+	for(auto h: lru) ::hts_close(h.second);
+	lru.clear();
+	if(b!=NULL) ::bam_destroy1(b);
+	b = NULL;
+	}
+
+/** index of the sample of 'b' in file->panels, from its read group. 0 if the file holds one sample, -1 if the read group is unknown */
+int BamW::sampleOf(const bam1_t* b) const {
+	if(this->file->rg2sample==NULL) return 0;
+	uint8_t* rg = ::bam_aux_get(b,"RG");
+	if(rg==NULL) return -1;
+	const char* id = ::bam_aux2Z(rg);
+	int sample_idx;
+	if(id==NULL || ::khash_str2int_get(this->file->rg2sample,id,&sample_idx)!=0) return -1;
+	return sample_idx;
+	}
+
+/** compute the base-level signals of 'rgn', one vector per SIGNAL_*, in a single pass over the reads.
+ * Each aligned base is counted once in the forward or the reverse depth, and once more in the low MAPQ
+ * depth for poorly mapped reads; the total depth is their sum. Clipped and split (SA tag) reads are
+ * counted at the position of the clip.
+ */
+void BamW::fetchSignals(int tid,const ChromStartEnd* rgn,bam1_t* b,std::vector<std::vector<int> >& signals,Saturation* saturation) {
+	fetchSignals(this->fp,tid,rgn,rgn->start,rgn->end,b,signals,saturation);
+	}
+
+/** the signals of the sample of this panel, see fetchSamples */
+void BamW::fetchSignals(samFile* in,int tid,const ChromStartEnd* rgn,int chunk_start,int chunk_end,bam1_t* b,std::vector<std::vector<int> >& signals,Saturation* saturation) {
+	std::vector<std::vector<std::vector<int> > > samples(1);
+	samples[0].swap(signals);
+	this->file->fetchSamples(in,tid,rgn,chunk_start,chunk_end,b,samples,saturation);
+	signals.swap(samples[std::max(0,this->rg_sample)]);
+	}
+
+/** the state of the saturating count of the samples of this file over a region of 'length' bases drawn in 'n_bins'
+ * columns, or NULL without X11BamCov::saturate_depth. To be deleted by the caller.
+ */
+Saturation* BamW::newSaturation(int length,int n_bins) const {
+	if(!owner->saturate_depth || owner->cap_depth<=0) return NULL;
+	return new Saturation(owner->cap_depth,length,n_bins,this->file->panels.empty()?1:this->file->panels.size());
+	}
+
+/** compute the signals of the reads of 'rgn' starting in the chunk [chunk_start,chunk_end], reading 'in'
+ * which may be another handle than 'fp' on the same file. samples[i] gets the signals of the sample of panels[i],
+ * or of all the reads if the file holds one sample: the reads are decoded once for all the samples, and dispatched
+ * by their read group. The reads starting before the region belong to its first chunk.
+ * samples[*][*][i] is the value at chunk_start+i: the vectors cover the chunk, plus the bases of the
+ * region covered by the reads ending after the chunk.
+ * With a 'saturation' (see Saturation, NULL otherwise), the reads whose columns all reached the cap are skipped without
+ * walking their cigar, but their clips are counted. The reads are still decoded: the depth of a column depends on reads
+ * that are not decoded yet. The vectors then only cover the chunk, the bases after it go to the next chunk.
+ */
+void BamW::fetchSamples(samFile* in,int tid,const ChromStartEnd* rgn,int chunk_start,int chunk_end,bam1_t* b,std::vector<std::vector<std::vector<int> > >& samples,Saturation* saturation) {
+	const int len_chunk = chunk_end - chunk_start + 1;
+	samples.resize(this->panels.empty()?1:this->panels.size());
+	for(size_t k=0;k< samples.size();k++) {
+		std::vector<std::vector<int> >& signals = samples[k];
+		signals.resize(NUM_SIGNALS);
+		for(size_t i=0;i< signals.size();i++) {
+			signals[i].assign(len_chunk,0);
+			}
+		// the reads of the previous chunks ending in this one
+		if(saturation!=NULL && !saturation->carry[k].empty()) {
+			for(size_t i=0;i< signals.size();i++) {
+				const std::vector<int>& carry = saturation->carry[k][i];
+				if(carry.size()>signals[i].size()) signals[i].resize(carry.size(),0);
+				std::copy(carry.begin(),carry.end(),signals[i].begin());
+				}
+			saturation->carry[k].clear();
+			}
+		}
+	// the default options use the kernel without the tests of the cap and of the base qualities
+	if(owner->filter.min_base_qual>0) {
+		if(saturation!=NULL) fetchSamplesKernel<true,true>(in,tid,rgn,chunk_start,chunk_end,b,samples,saturation);
+		else fetchSamplesKernel<false,true>(in,tid,rgn,chunk_start,chunk_end,b,samples,saturation);
+		}
+	else
+		{
+		if(saturation!=NULL) fetchSamplesKernel<true,false>(in,tid,rgn,chunk_start,chunk_end,b,samples,saturation);
+		else fetchSamplesKernel<false,false>(in,tid,rgn,chunk_start,chunk_end,b,samples,saturation);
+		}
+	if(saturation==NULL) return;
+	const int offset = chunk_start - rgn->start;
+	for(size_t k=0;k< samples.size();k++) {
+		std::vector<std::vector<int> >& signals = samples[k];
+		// the bases of the chunk are final: move the frontiers over them before they are encoded
+		const int sat_signals[3]={SIGNAL_FORWARD,SIGNAL_REVERSE,SIGNAL_LOW_MAPQ};
+		for(int j=0;j< 3;j++) {
+			const std::vector<int>& v = signals[sat_signals[j]];
+			int& frontier = saturation->frontiers[k*3+j];
+			while(frontier>=offset && frontier-offset < (int)v.size() && v[frontier-offset] >= saturation->cap) frontier++;
+			}
+		if((int)signals[0].size() <= len_chunk) continue;
+		saturation->carry[k].resize(NUM_SIGNALS);
+		for(size_t i=0;i< signals.size();i++) {
+			saturation->carry[k][i].assign(signals[i].begin()+len_chunk,signals[i].end());
+			signals[i].resize(len_chunk);
+			}
+		}
+	}
+
+/** the loop of fetchSamples over the reads, 'samples' being initialized. CAPPED: with a 'saturation'.
+ * BASE_QUALITY: with ReadFilter::min_base_qual, the query position is then followed along the cigar.
+ */
+template<bool CAPPED,bool BASE_QUALITY>
+void BamW::fetchSamplesKernel(samFile* in,int tid,const ChromStartEnd* rgn,int chunk_start,int chunk_end,bam1_t* b,std::vector<std::vector<std::vector<int> > >& samples,Saturation* saturation) {
+	int ret = 0;
+	int len_rgn = (int)samples[0][0].size();
+	const ReadFilter filter = owner->filter;
+	// offset of the chunk in the region
+	const int offset = chunk_start - rgn->start;
+	// 0-based query: also get the reads ending just before the first position, whose trailing clip is on it
+	hts_itr_t *iter = ::sam_itr_queryi(this->idx, tid,std::max(0,chunk_start-2),chunk_end);
+	if(this->readahead!=NULL) this->readahead->prefetch(iter);
+	while ((ret = bam_itr_next(in, iter, b)) >= 0)
+		{
+		const bam1_core_t *c = &b->core;
+		if ( !filter.accept(c) ) continue;
+		// a read overlapping the chunk but starting in the previous one is counted by the previous chunk
+		if ( c->pos + 1 < chunk_start && chunk_start > rgn->start ) continue;
+		
+		const int sample_idx = sampleOf(b);
+		if(sample_idx< 0) continue;
+		
+		// the vectors grow up to the end of the region for the reads ending after the chunk, +1 for a trailing clip
+		const int end_pos = (int)::bam_endpos(b);
+		int needed = std::min(rgn->end,end_pos + 1) - chunk_start + 1;
+		if(needed > len_rgn) {
+			len_rgn = needed;
+			for(auto& signals: samples) {
+				for(size_t i=0;i< signals.size();i++) signals[i].resize(len_rgn,0);
+				}
+			}
+		std::vector<std::vector<int> >& signals = samples[sample_idx];
+		int* low_mapq_depth = &signals[SIGNAL_LOW_MAPQ][0];
+		int* clip_count = &signals[SIGNAL_CLIP][0];
+		int* split_count = &signals[SIGNAL_SPLIT][0];
+		int* total = &signals[SIGNAL_DEPTH][0];
+		uint32_t *cigar = bam_get_cigar(b);
+		if(cigar==NULL || c->n_cigar==0) continue;
+		
+		int* depth = &signals[bam_is_rev(b)?SIGNAL_REVERSE:SIGNAL_FORWARD][0];
+		int* low_mapq = (c->qual < owner->low_mapq ? low_mapq_depth : NULL);
+		// the SA tag is only looked up for clipped reads
+		int first_op = bam_cigar_op(cigar[0]);
+		int last_op = bam_cigar_op(cigar[c->n_cigar-1]);
+		const bool first_clip = (first_op==BAM_CSOFT_CLIP || first_op==BAM_CHARD_CLIP);
+		const bool last_clip = (c->n_cigar>1 && (last_op==BAM_CSOFT_CLIP || last_op==BAM_CHARD_CLIP));
+		bool split = (first_clip || last_clip) && bam_aux_get(b,"SA")!=NULL;
+		if(CAPPED) {
+			// offsets in the region of the first and the last base of the read
+			const int first = std::max(c->pos + 1,rgn->start) - rgn->start;
+			const int last = std::min(end_pos,rgn->end) - rgn->start;
+			bool saturated = (first<=last);
+			for(int j=0;saturated && j< 3;j++) {
+				// the strand of the read, and the low MAPQ depth for a poorly mapped read
+				if(j==0 && bam_is_rev(b)) continue;
+				if(j==1 && !bam_is_rev(b)) continue;
+				if(j==2 && low_mapq==NULL) continue;
+				const int* v = &signals[j==0?SIGNAL_FORWARD:(j==1?SIGNAL_REVERSE:SIGNAL_LOW_MAPQ)][0];
+				int& frontier = saturation->frontiers[sample_idx*3+j];
+				frontier = std::max(frontier,saturation->columnStart(first));
+				// a frontier before the chunk is on a final base below the cap
+				while(frontier>=offset && frontier-offset < len_rgn && v[frontier-offset] >= saturation->cap) frontier++;
+				saturated = (frontier >= saturation->columnEnd(last));
+				}
+			if(saturated) {
+				// only the clips are counted, at the first base after the clip or after the last aligned base
+				const int clips[2]={first_clip ? c->pos + 1 - chunk_start : -1,last_clip ? end_pos + 1 - chunk_start : -1};
+				for(int k=0;k< 2;k++) {
+					if(clips[k]< 0 || clips[k] >= len_rgn || clips[k] + chunk_start > rgn->end) continue;
+					clip_count[clips[k]]++;
+					if(split) split_count[clips[k]]++;
+					}
+				continue;
+				}
+			}
+		// base qualities, and position in the read. A read without qualities (0xff) counts all its bases
+		const uint8_t* quals = (BASE_QUALITY ? bam_get_qual(b) : NULL);
+		const bool has_quals = BASE_QUALITY && c->l_qseq>0 && quals[0]!=0xff;
+		int qpos = 0;
+		int ref1 = c->pos + 1;
+		
+		for (unsigned int icig=0; icig< c->n_cigar && ref1 <= rgn->end; icig++)
+	    		{
+			int op  = bam_cigar_op(cigar[icig]);
+			int len = bam_cigar_oplen(cigar[icig]);
+			    
+		    	switch(op)
+		    		{
+		    		case BAM_CPAD: break;
+		    		case BAM_CINS: qpos+=len; break;
+		    		case BAM_CDEL: case BAM_CREF_SKIP : ref1+=len; break;
+		    		case BAM_CSOFT_CLIP: case BAM_CHARD_CLIP:
+		    			{
+		    			int idx1 = ref1 - chunk_start;
+		    			if(op==BAM_CSOFT_CLIP) qpos+=len;
+		    			if(idx1< 0 || idx1 >= len_rgn) break;
+		    			// 'H' next to 'S' is the same clip
+		    			if(icig>0 && (bam_cigar_op(cigar[icig-1])==BAM_CSOFT_CLIP || bam_cigar_op(cigar[icig-1])==BAM_CHARD_CLIP)) break;
+		    			clip_count[idx1]++;
+		    			if(split) split_count[idx1]++;
+		    			break;
+		    			}
+		    		case BAM_CMATCH: case BAM_CEQUAL : case BAM_CDIFF:
+		    			{
+		    			// the bases of the operation in the chunk and in the region
+		    			const int from = std::max(ref1,chunk_start) - chunk_start;
+		    			const int to = std::min(std::min(ref1 + len - 1,rgn->end) - chunk_start + 1,len_rgn);
+		    			const uint8_t* qual = (has_quals ? quals + qpos + (chunk_start + from - ref1) : NULL);
+		    			for(int idx1=from;idx1< to ;++idx1) {
+						if(BASE_QUALITY && has_quals && qual[idx1-from] < filter.min_base_qual) continue;
+						total[idx1]++;
+						depth[idx1]++;
+						if(low_mapq!=NULL) low_mapq[idx1]++;
+		    				}
+		    			ref1+=len;
+		    			qpos+=len;
+		    			break;
+		    			}
+		    		default: cerr << "boum ??" << op << " " << BAM_CMATCH << endl;break;
+		    		}
+			}
+		}
+	::hts_itr_destroy(iter);
+	}
+
+/** offset in the compressed file of the first read overlapping 'pos', from the index only. -1 if there is no read */
+int64_t BamW::indexOffset(int tid,int pos) const {
+	hts_itr_t *iter = ::sam_itr_queryi(this->idx,tid,pos,pos+1);
+	if(iter==NULL) return -1;
+	int64_t off = (iter->n_off>0?(int64_t)(iter->off[0].u>>16):-1);
+	::hts_itr_destroy(iter);
+	return off;
+	}
+
+#define PREVIEW_SAMPLES 200
+#define PREVIEW_WINDOW 1000
+/** read the k-th of min(n_bins,PREVIEW_SAMPLES) windows of PREVIEW_WINDOW bases of 'rgn' drawn in 'n_bins' columns, evenly
+ * spaced and reached through the index, see X11BamCov::sampleSignals. The signals of each sample of the file are written in
+ * 'samples' like fetchSamples. The window gives the value of the columns [*col1,*col2). The file is read with 'in', or with
+ * 'fp' if 'in' is NULL.
+ */
+void BamW::sampleWindow(samFile* in,int tid,const ChromStartEnd* rgn,int n_bins,int k,bam1_t* b,std::vector<std::vector<std::vector<int> > >& samples,int* col1,int* col2) {
+	const int n_samples = std::min(n_bins,PREVIEW_SAMPLES);
+	ChromStartEnd w;
+	w.chrom = rgn->chrom;
+	*col1 = (int)(((int64_t)k*n_bins)/n_samples);
+	*col2 = (int)(((int64_t)(k+1)*n_bins)/n_samples);
+	int64_t center = rgn->start + (((int64_t)(*col1+*col2))*rgn->length())/(2*n_bins);
+	w.start = std::max(rgn->start,(int)(center - PREVIEW_WINDOW/2));
+	w.end = std::min(rgn->end,w.start + PREVIEW_WINDOW - 1);
+	// the window gives one value
+	std::unique_ptr<Saturation> saturation(this->file->newSaturation(w.length(),1));
+	if(in!=NULL) {
+		this->file->fetchSamples(in,tid,&w,w.start,w.end,b,samples,saturation.get());
+		}
+	else
+		{
+		std::lock_guard<std::mutex> guard(this->file->lock);
+		this->file->fetchSamples(this->file->fp,tid,&w,w.start,w.end,b,samples,saturation.get());
+		}
+	}
+
+/** set the columns [col1,col2) of a preview to the value of the 'signals' of a window, see BamW::sampleWindow. Not smoothed */
+static void previewColumns(const std::vector<std::vector<int> >& signals,int cap_depth,int col1,int col2,float* bam_min,float* bam_max,float** bam_signals) {
+	float values[NUM_SIGNALS];
+	float mn,mx;
+	binMinMeanMax(&signals[SIGNAL_DEPTH][0],signals[SIGNAL_DEPTH].size(),1,&mn,&values[SIGNAL_DEPTH],&mx);
+	for(int sig=0;sig< NUM_SIGNALS;sig++) {
+		if(sig==SIGNAL_DEPTH) continue;
+		if(SIGNAL_IS_EVENT(sig)) {
+			binMinMeanMax(&signals[sig][0],signals[sig].size(),1,NULL,NULL,&values[sig]);
 			}
+		else
+			{
+			binMinMeanMax(&signals[sig][0],signals[sig].size(),1,NULL,&values[sig],NULL);
+			}
+		}
+	if(cap_depth>0) {
+		mn = std::min(mn,(float)cap_depth);
+		mx = std::min(mx,(float)cap_depth);
+		for(int sig=0;sig< NUM_SIGNALS;sig++) {
+			if(!SIGNAL_IS_EVENT(sig)) values[sig] = std::min(values[sig],(float)cap_depth);
+			}
+		}
+	for(int i=col1;i< col2;i++) {
+		bam_min[i] = mn;
+		bam_max[i] = mx;
+		for(int sig=0;sig< NUM_SIGNALS;sig++) bam_signals[sig][i] = values[sig];
 		}
+	}
 
+BamW::BamW(X11BamCov* owner,std::string fn,std::string sample,uint64_t mapped_reads):owner(owner),filename(fn),sample(sample),
+	mapped_reads(mapped_reads),scale(1.0f),fp(NULL),header(NULL),idx(NULL),bad_flag(false),approximate(false),
+	file(this),rg_sample(-1),rg2sample(NULL),readahead(NULL) {
 	}
 
 BamW::~BamW() {
-	::hts_idx_destroy(idx);
-	::bam_hdr_destroy(hdr);
-	::hts_close(fp);
+	// the other samples of a file share its handles
+	if(this->file!=this) return;
+	if(rg2sample!=NULL) ::khash_str2int_destroy_free(rg2sample);
+	if(readahead!=NULL) delete readahead;
+	if(idx!=NULL) ::hts_idx_destroy(idx);
+	if(fp!=NULL) ::hts_close(fp);
 	}
 
 
-X11BamCov::X11BamCov():palette(0),show_sample_name(true),smooth_factor(20) {
+X11BamCov::X11BamCov():regions(0),palette(0),show_sample_name(true),show_envelope(true),smooth_factor(20),cache(NULL),server(NULL),track_mode(TRACK_DEPTH),signal(SIGNAL_DEPTH),low_mapq(20),preview_length(1000000),refining(false),saturate_depth(false),merge_distance(-1),readahead_kb(-1),reference(NULL),gc_correction(false),pool((int)std::thread::hardware_concurrency()),approx_mode(APPROX_OFF),save_out(NULL),record_out(NULL),has_deadline(false),has_timed_paint(false),timed_refining(false),goto_prompt(false),
+	overview(false),overview_first(0),overview_cols(1),overview_rows(1),thumb_clock(0),thumb_keep_first(0),thumb_keep_end(0),thumb_stop(false),thumb_notified(false) {
 	region_idx = 0UL;
 	window_width = 0;
 	window_height = 0;
@@ -257,16 +1484,87 @@ X11BamCov::X11BamCov():palette(0),show_sample_name(true),smooth_factor(20) {
 
 
 X11BamCov::~X11BamCov() {
+	stopThumbnails();
+	for(auto& h: pool_handles) h.close();
 	for(auto iter:bams) {
 		delete iter;
 		}
-	for(auto iter:regions) {
+	for(auto iter:headers) {
 		delete iter;
 		}
+	if(regions!=0) delete regions;
+	if(cache!=NULL) delete cache;
+	if(server!=NULL) delete server;
+	if(reference!=NULL) ::fai_destroy(reference);
 	if(palette!=0) delete palette;
 	}
+/** return the SharedHeader having the same dictionary as 'h', which is then released, or register 'h' as a new one */
+SharedHeader* X11BamCov::shareHeader(bam_hdr_t* h) {
+	uint64_t sig = SharedHeader::hash(h);
+	for(auto header: headers) {
+		if(!header->same(h,sig)) continue;
+		::bam_hdr_destroy(h);
+		return header;
+		}
+	SharedHeader* header = new SharedHeader(h);
+	headers.push_back(header);
+	return header;
+	}
+
+/** bin the base-level 'signals' into 'n_bins' columns: 'bam_min' and 'bam_max' get the raw depth envelope,
+ * bam_signals[SIGNAL_*] the mean of each depth signal, smoothed by a sliding window of length/smooth_factor on each side,
+ * or the highest count for the event signals. With 'cap_depth'>0, the depth signals are capped at each base first.
+ * Only the runs of the signals are visited.
+ */
+static void binSignals(const std::vector<RunLengthCoverage>& signals,int n_bins,int smooth_factor,int cap_depth,float* bam_min,float* bam_max,float** bam_signals) {
+	// the depths are capped base by base before the binning and the smoothing, so the columns are the same whether the
+	// reads above the cap were counted or skipped, see Saturation
+	RunLengthCoverage capped_depth,capped;
+	const RunLengthCoverage* coverage = &signals[SIGNAL_DEPTH];
+	if(cap_depth>0) {
+		capped_depth.assignCapped(*coverage,cap_depth);
+		coverage = &capped_depth;
+		}
+	// the envelope shows the raw depth, so a single-base dropout remains visible
+	coverage->bin(n_bins,bam_min,bam_signals[SIGNAL_DEPTH],bam_max);
+	const size_t smooth = (smooth_factor>1 ? (size_t)(coverage->length()/(double)smooth_factor) : 0);
+
+	for(int sig=0;sig< NUM_SIGNALS;sig++) {
+		float* bam_signal = bam_signals[sig];
+		if(SIGNAL_IS_EVENT(sig)) {
+			// highest number of reads at one position of the column
+			signals[sig].bin(n_bins,NULL,NULL,bam_signal);
+			continue;
+			}
+		const RunLengthCoverage* signal = &signals[sig];
+		if(sig==SIGNAL_DEPTH) {
+			signal = coverage;
+			}
+		else if(cap_depth>0)
+			{
+			capped.assignCapped(*signal,cap_depth);
+			signal = &capped;
+			}
+		if(smooth>0) {
+			signal->binSmoothed(n_bins,smooth,bam_signal);
+			}
+		else if(sig!=SIGNAL_DEPTH)
+			{
+			signal->bin(n_bins,NULL,bam_signal,NULL);
+			}
+		}
+	}
+
 #define MARGIN_TOP 20
 void X11BamCov::paint() {
+if(this->overview) {
+	paintOverview();
+	return;
+	}
+if(this->approx_mode!=APPROX_OFF) {
+	paintApprox();
+	return;
+	}
 GC gc = ::XCreateGC(this->display, this->window, 0, 0);
 XSetForeground(this->display, gc, WhitePixel(this->display, this->screen_number));
 ::XFillRectangle(this->display,this->window, gc,0,0,this->window_width,this->window_height);
@@ -282,7 +1580,7 @@ for(auto bam: this->bams) {
 	}
 XSetForeground(this->display, gc, BlackPixel(this->display, this->screen_number));
 
-ChromStartEnd* rgn = this->regions[this->region_idx];
+ChromStartEnd* rgn = this->regions->get(this->region_idx);
 string win_title;
 {
 	ostringstream os;
@@ -295,9 +1593,12 @@ string win_title;
 	ostringstream os;
 	os << win_title
 			<< " maxDepth:"<< max_depth << " length: "<< niceInt(rgn->length())
+			<< (this->signal==SIGNAL_DEPTH?"":" ") << (this->signal==SIGNAL_DEPTH?"":SIGNAL_NAMES[this->signal])
+			<< (&currentSignal()==&this->gc_corrected?" GC-corrected":"")
+			<< (this->track_mode==TRACK_RATIO?" ratio/cohort":(this->track_mode==TRACK_ZSCORE?" z-score/cohort":""))
 			<< " \"" << rgn->label << "\" "
 			<< " (" << niceInt(this->region_idx+1) << "/"
-			<< niceInt((int)this->regions.size()) << ")"
+			<< niceInt((int)this->regions->size()) << ")"
 			;
 	string title= os.str();
 	int title_width= title.size()*12;
@@ -309,34 +1610,89 @@ string win_title;
 			);
 	}
 
-for(auto bam: this->bams) {
+double max_signal = maxEventSignal();
+for(size_t bam_idx=0;bam_idx< this->bams.size();++bam_idx) {
+	paintBam(gc,bam_idx,rgn,max_signal);
+	}
+flushPaint();
+XFreeGC(this->display,gc);
+}
 
-	int ruledy=1.0;
-	if(bam->max_depth>100) {
-		ruledy=100;
-	} if(bam->max_depth>50) {
-		ruledy=10;
-	} else if(bam->max_depth>10) {
-		ruledy=5;
-	}else
-	{
-		ruledy=1;
+/** scale of the signals that are not a depth: the highest value of the current signal */
+double X11BamCov::maxEventSignal() const {
+	double max_signal = 1.0;
+	if(!SIGNAL_IS_EVENT(this->signal)) return max_signal;
+	const CoverageMatrix& current = this->binned[this->signal];
+	for(size_t bam_idx=0;bam_idx< current.rows();++bam_idx) {
+		for(size_t i=0;i< current.cols();i++) max_signal = std::max(max_signal,(double)current.get(bam_idx,i));
+		}
+	return max_signal;
 	}
 
-   vector<XPoint> points;
-   XPoint pt1={(pixel_t)bam->bounds.x,(pixel_t)(bam->bounds.y+bam->bounds.height)};
-   points.push_back(pt1);
-   for(size_t i=0;i< bam->coverage.size();i++)
-   		{
-   		double h = (bam->coverage[i]/bam->max_depth)*bam->bounds.height;
-   		XPoint pt;
+/** draw the panel of one bam */
+void X11BamCov::paintBam(GC gc,size_t bam_idx,const ChromStartEnd* rgn,double max_signal) {
+	BamW* bam = this->bams[bam_idx];
+	const CoverageMatrix& current = currentSignal();
+	XSetForeground(this->display, gc, WhitePixel(this->display, this->screen_number));
+	::XFillRectangle(this->display,this->window, gc,bam->bounds.x,bam->bounds.y,bam->bounds.width,bam->bounds.height);
+	const float* values = current.row(bam_idx);
+	// range of the values, the polygon is drawn from the value '0'
+	double vmin = 0.0;
+	double vmax = (SIGNAL_IS_EVENT(this->signal)?max_signal:bam->max_depth);
+	// horizontal rulers: value and label
+	vector<pair<double,string> > rulers;
+	if(this->track_mode==TRACK_DEPTH) {
+		int ruledy=1.0;
+		if(vmax>100) {
+			ruledy=100;
+		} if(vmax>50) {
+			ruledy=10;
+		} else if(vmax>10) {
+			ruledy=5;
+		}else
+		{
+			ruledy=1;
+		}
+		for(double curr_depth = ruledy;curr_depth <= vmax;curr_depth+=ruledy) {
+			char tmp[20];
+			sprintf(tmp,"%d",(int)curr_depth);
+			rulers.push_back(make_pair(curr_depth,string(tmp)));
+			}
+		}
+	else if(this->track_mode==TRACK_RATIO) {
+		// ratio - 1
+		values = this->cohort_track.row(bam_idx);
+		vmin = -1.0;
+		vmax = 2.0;
+		rulers.push_back(make_pair(-0.5,string("0.5")));
+		rulers.push_back(make_pair(0.0,string("1")));
+		rulers.push_back(make_pair(0.5,string("1.5")));
+		rulers.push_back(make_pair(1.0,string("2")));
+		}
+	else
+		{
+		values = this->cohort_track.row(bam_idx);
+		vmin = -5.0;
+		vmax = 5.0;
+		rulers.push_back(make_pair(-3.0,string("-3")));
+		rulers.push_back(make_pair(0.0,string("0")));
+		rulers.push_back(make_pair(3.0,string("3")));
+		}
+	#define VALUE_TO_Y(v) (bam->bounds.y + bam->bounds.height - ((std::max(vmin,std::min(vmax,(double)(v)))-vmin)/(vmax-vmin)) * bam->bounds.height)
+
+   vector<XPoint> points;
+   XPoint pt1={(pixel_t)bam->bounds.x,(pixel_t)VALUE_TO_Y(0)};
+   points.push_back(pt1);
+   for(size_t i=0;i< current.cols();i++)
+   		{
+   		XPoint pt;
    		pt.x = (pixel_t)(bam->bounds.x+i);
-   		pt.y = (pixel_t)(bam->bounds.y+bam->bounds.height - h);
+   		pt.y = (pixel_t)VALUE_TO_Y(values[i]);
    		points.push_back(pt);
    		}
    XPoint pt2={
 		(pixel_t)(bam->bounds.width+bam->bounds.x),
-		(pixel_t)(bam->bounds.y+bam->bounds.height)
+		(pixel_t)VALUE_TO_Y(0)
 		};
    points.push_back(pt2);
    points.push_back(pt1);
@@ -348,36 +1704,62 @@ for(auto bam: this->bams) {
 	::XFillRectangle(this->display,this->window, gc,x1,bam->bounds.y,(x2-x1),bam->bounds.height);
   }
   // print ruler
-  double curr_depth = ruledy;
-  while(curr_depth <= bam->max_depth) {
-   	  double y =  bam->bounds.y + bam->bounds.height- ((curr_depth/bam->max_depth) * bam->bounds.height);
-	  if(y <  bam->bounds.y) break;
+  for(auto ruler: rulers) {
+   	  double y =  VALUE_TO_Y(ruler.first);
 	  XSetForeground(this->display, gc,palette->gray(0.8).pixel);
 	  XDrawLine(this->display, this->window, gc, (int)bam->bounds.x, (int)y,(int)(bam->bounds.x+bam->bounds.width), (int)y);
-	  curr_depth+=ruledy;
   	  }
 
 
+   // the envelope is the raw depth, it is hidden when the depth is corrected for the GC content
+   if(this->track_mode==TRACK_DEPTH && this->signal==SIGNAL_DEPTH && this->show_envelope && &current!=&this->gc_corrected) {
+	// min-max envelope behind the mean
+	const float* bam_min = this->binned_min.row(bam_idx);
+	const float* bam_max = this->binned_max.row(bam_idx);
+	vector<XPoint> envelope;
+	for(size_t i=0;i< current.cols();i++) {
+		XPoint pt = {(pixel_t)(bam->bounds.x+i),(pixel_t)VALUE_TO_Y(bam_max[i])};
+		envelope.push_back(pt);
+		}
+	for(size_t i=current.cols();i>0;i--) {
+		XPoint pt = {(pixel_t)(bam->bounds.x+i-1),(pixel_t)VALUE_TO_Y(bam_min[i-1])};
+		envelope.push_back(pt);
+		}
+	XSetForeground(this->display, gc,palette->gray(0.65).pixel);
+	if(!envelope.empty()) ::XFillPolygon(this->display,this->window, gc, &envelope[0], (int)envelope.size(), Complex,CoordModeOrigin);
+	}
    XSetForeground(this->display, gc,palette->dark_slate_gray.pixel);
    ::XFillPolygon(this->display,this->window, gc, &points[0], (int)points.size(), Complex,CoordModeOrigin);
 
+   if(!this->gc_content.empty()) {
+	// GC fraction: 0 at the bottom of the panel, 1 at the top. The line is broken where the reference has no A/C/G/T
+	XSetForeground(this->display, gc,palette->blue.pixel);
+	vector<XPoint> gc_line;
+	for(size_t i=0;i<= this->gc_content.size();i++) {
+		if(i==this->gc_content.size() || this->gc_content[i]<0.0f) {
+			if(gc_line.size()>1) ::XDrawLines(this->display,this->window, gc, &gc_line[0], (int)gc_line.size(),CoordModeOrigin);
+			gc_line.clear();
+			continue;
+			}
+		XPoint pt = {(pixel_t)(bam->bounds.x+i),(pixel_t)(bam->bounds.y+bam->bounds.height-this->gc_content[i]*bam->bounds.height)};
+		gc_line.push_back(pt);
+		}
+	}
+
  
   
 
 
   
-   curr_depth = ruledy;
-   while(curr_depth <= bam->max_depth) {
-   	  double y =  bam->bounds.y + bam->bounds.height- ((curr_depth/bam->max_depth) * bam->bounds.height);
-   	  if(y <  bam->bounds.y) break;
+   for(auto ruler: rulers) {
+   	  double y =  VALUE_TO_Y(ruler.first);
    	  XSetForeground(this->display, gc,palette->gray(0.8).pixel);
 	  XSetFunction(this->display, gc, GXxor);
    	  XDrawLine(this->display, this->window, gc, (int)bam->bounds.x, (int)y,(int)(bam->bounds.x+bam->bounds.width), (int)y);
           XSetFunction(this->display, gc, GXcopy);
 
    	  XSetForeground(this->display, gc,palette->gray(0.5).pixel);
-   	  char tmp[20];
-   	  sprintf(tmp,"%d",(int)curr_depth);
+   	  const char* tmp = ruler.second.c_str();
    	  if(y-7 > bam->bounds.y) {
 		  hershey.paint(this->display,this->window,gc,
 				tmp,
@@ -387,9 +1769,8 @@ for(auto bam: this->bams) {
 				7
 				);
 		  }
-   	  curr_depth+=ruledy;
      }
-   
+   #undef VALUE_TO_Y
 
   
 
@@ -403,25 +1784,38 @@ for(auto bam: this->bams) {
 		);
 	}
    XSetForeground(this->display, gc, palette->gray(0.0).pixel);
+   if(bam->approximate) {
+	// dashed frame and label while the panel shows the preview
+	XSetForeground(this->display, gc, palette->red.pixel);
+	hershey.paint(this->display,this->window, gc,"preview",
+		bam->bounds.x+bam->bounds.width-std::min((int)bam->bounds.width,70),
+		bam->bounds.y+1,
+		std::min((int)bam->bounds.width,70),
+		std::min(10,(int)(bam->bounds.height/10))
+		);
+	XSetLineAttributes(this->display, gc, 1, LineOnOffDash, CapButt, JoinMiter);
+	}
    ::XDrawRectangle(this->display,this->window, gc,
 		bam->bounds.x,
 		bam->bounds.y,
 		bam->bounds.width,
 		bam->bounds.height
 		);
+   XSetLineAttributes(this->display, gc, 1, LineSolid, CapButt, JoinMiter);
    }
-XFlush(this->display);
-}
 
 
 
 
 void X11BamCov::repaint() {
 
-int ret = 0;
-ChromStartEnd* rgn = this->regions[this->region_idx];
-vector<int> coverage;
-coverage.resize(rgn->length(),0);
+ChromStartEnd* rgn = this->regions->get(this->region_idx);
+// bams read at once on all the threads
+vector<size_t> exact;
+// bams previewed at once on all the threads, see sampleSignals
+vector<size_t> sampled;
+// large regions are first drawn from a sample of the reads, see refine()
+const bool preview = (this->preview_length>0 && rgn->length()>this->preview_length);
 
 int curr_x=0;
 int curr_y=0;
@@ -435,15 +1829,43 @@ int rect_h = ((this->window_height-MARGIN_TOP) /n_rows);
 if(rect_h< 1) return;
 vector<int> counts;
 
-bam1_t *b = ::bam_init1();
+if(this->overview) {
+	repaintOverview();
+	return;
+	}
+if(this->approx_mode!=APPROX_OFF) {
+	// only the layout is needed: no read is decoded
+	for(size_t bam_idx=0;bam_idx< this->bams.size();++bam_idx) {
+		BamW* bam = this->bams[bam_idx];
+		bam->bounds.x = (bam_idx%this->num_columns)*rect_w;
+		bam->bounds.y = MARGIN_TOP + (bam_idx/this->num_columns)*rect_h;
+		bam->bounds.width = rect_w;
+		bam->bounds.height = rect_h;
+		}
+	this->refining = false;
+	indexDensity(rect_w);
+	paint();
+	return;
+	}
+
+this->binned.resize(NUM_SIGNALS);
+for(size_t i=0;i< this->binned.size();i++) {
+	this->binned[i].resize(this->bams.size(),rect_w);
+	}
+this->binned_min.resize(this->bams.size(),rect_w);
+this->binned_max.resize(this->bams.size(),rect_w);
+// the reference is read once for all the bams
+gcContent(rgn,rect_w);
 
 //reload data for each bam
-for(auto bam: this->bams) {
+for(size_t bam_idx=0;bam_idx< this->bams.size();++bam_idx) {
+	BamW* bam = this->bams[bam_idx];
 	counts.clear();
 
 
 
 	bam->bad_flag = false;
+	bam->approximate = false;
 	bam->max_depth = 1.0;
 	bam->bounds.y = MARGIN_TOP + curr_y*rect_h;
 	bam->bounds.x = curr_x*rect_w;
@@ -457,117 +1879,665 @@ for(auto bam: this->bams) {
 		}
 	
 
-	bam->coverage.clear();
-	
-	bam->coverage.resize(bam->bounds.width,0);
-	std::fill(coverage.begin(),coverage.end(),0);
-	
-	
+	// the bams of the server are fetched at once, below
+	if(bam->isRemote()) continue;
 
-	int tid = ::bam_name2id(bam->hdr, rgn->chrom.c_str());
-	if(tid<0 && starts_with(rgn->chrom,"chr"))
+	int tid = (rgn->tid<0?-1:bam->header->region2tid[rgn->tid]);
+	if(tid<0) {
+		bam->bad_flag = true;
+		cerr << "[WARN] No chromosome " << rgn->chrom << " in "<< bam ->filename << endl;
+		continue;
+		}
+	if(preview) {
+		if(!thumbnailPreview(bam_idx,rect_w)) sampled.push_back(bam_idx);
+		continue;
+		}
+	exact.push_back(bam_idx);
+	}
+sampleSignals(sampled,rgn,rect_w);
+if(this->server!=NULL) fetchRemote(rgn,rect_w);
+loadBinned(exact,rgn);
+this->refining = preview;
+computeCohortTrack();
+paint();
+refine();
+}
+
+/** split the panels 'bam_idxs' in batches of the panels of at most MAX_JOB_FILES files. All the panels of a file
+ * are in the same batch, so loadSignals reads the file once for all its samples. The panels keep their order in a batch.
+ */
+void X11BamCov::batchByFile(const std::vector<size_t>& bam_idxs,std::vector<std::vector<size_t> >& batches) const {
+	batches.clear();
+	// batch of each file, and number of files of the last batch
+	std::map<const BamW*,size_t> file2batch;
+	size_t n_files = 0;
+	for(size_t bam_idx: bam_idxs) {
+		const BamW* file = this->bams[bam_idx]->file;
+		auto r = file2batch.find(file);
+		if(r==file2batch.end()) {
+			if(batches.empty() || n_files>=MAX_JOB_FILES) {
+				batches.push_back(std::vector<size_t>());
+				n_files = 0;
+				}
+			r = file2batch.insert(make_pair(file,batches.size()-1)).first;
+			n_files++;
+			}
+		batches[r->second].push_back(bam_idx);
+		}
+	}
+
+/** approximate the binned signals of the bams 'bam_idxs' over 'rgn' in 'n_bins' columns, see BamW::sampleWindow. Each window
+ * of a file is read once for all its panels. The windows of all the files are read on all the threads of 'pool', each thread
+ * with its own handles on the files (see ThreadHandles).
+ */
+void X11BamCov::sampleSignals(const std::vector<size_t>& bam_idxs,const ChromStartEnd* rgn,int n_bins) {
+	const size_t n_samples = (size_t)std::min(n_bins,PREVIEW_SAMPLES);
+	// the panels of each file
+	std::vector<std::vector<size_t> > files;
+	std::map<const BamW*,size_t> file2idx;
+	for(size_t bam_idx: bam_idxs) {
+		const BamW* file = this->bams[bam_idx]->file;
+		auto r = file2idx.find(file);
+		if(r==file2idx.end()) {
+			r = file2idx.insert(make_pair(file,files.size())).first;
+			files.push_back(std::vector<size_t>());
+			}
+		files[r->second].push_back(bam_idx);
+		}
+	if(this->pool_handles.size()< (size_t)this->pool.size()) this->pool_handles.resize(this->pool.size());
+	std::vector<std::vector<std::vector<std::vector<int> > > > scratch(this->pool.size());
+	this->pool.run(files.size()*n_samples,[&](size_t task,int t) {
+		const std::vector<size_t>& panels = files[task/n_samples];
+		BamW* file = this->bams[panels[0]]->file;
+		ThreadHandles& handles = this->pool_handles[t];
+		if(handles.b==NULL) handles.b = ::bam_init1();
+		std::vector<std::vector<std::vector<int> > >& samples = scratch[t];
+		int col1,col2;
+		file->sampleWindow(handles.get(file),file->header->region2tid[rgn->tid],rgn,n_bins,(int)(task%n_samples),handles.b,samples,&col1,&col2);
+		for(size_t bam_idx: panels) {
+			float* bam_signals[NUM_SIGNALS];
+			for(int sig=0;sig< NUM_SIGNALS;sig++) bam_signals[sig] = this->binned[sig].row(bam_idx);
+			previewColumns(samples[std::max(0,this->bams[bam_idx]->rg_sample)],this->cap_depth,col1,col2,
+				this->binned_min.row(bam_idx),this->binned_max.row(bam_idx),bam_signals);
+			}
+		});
+	for(size_t bam_idx: bam_idxs) {
+		BamW* bam = this->bams[bam_idx];
+		const float* bam_max = this->binned_max.row(bam_idx);
+		bam->max_depth = std::max(1.0,(double)*std::max_element(bam_max,bam_max+n_bins));
+		bam->approximate = true;
+		}
+	}
+
+/** compute the exact binned signals of the bams 'bam_idxs', the panels of MAX_JOB_FILES files at a time */
+void X11BamCov::loadBinned(const std::vector<size_t>& bam_idxs,const ChromStartEnd* rgn) {
+	std::vector<std::vector<size_t> > batches;
+	batchByFile(bam_idxs,batches);
+	for(const std::vector<size_t>& batch: batches) {
+		std::vector<SignalJob> jobs(batch.size());
+		for(size_t j=0;j< jobs.size();j++) {
+			jobs[j].bam_idx = batch[j];
+			jobs[j].n_bins = (int)this->binned_min.cols();
+			jobs[j].tid = this->bams[jobs[j].bam_idx]->header->region2tid[rgn->tid];
+			jobs[j].rgn = rgn;
+			}
+		loadSignals(jobs);
+		this->pool.run(jobs.size(),[&](size_t j,int) {
+			const size_t bam_idx = jobs[j].bam_idx;
+			vector<RunLengthCoverage>& signals = jobs[j].signals;
+			BamW* bam = this->bams[bam_idx];
+			bam->max_depth = std::max(1.0,(double)signals[SIGNAL_DEPTH].max());
+			if(this->cap_depth>0) bam->max_depth=std::min(bam->max_depth,(double)this->cap_depth);
+
+			float* bam_signals[NUM_SIGNALS];
+			for(int sig=0;sig< NUM_SIGNALS;sig++) bam_signals[sig] = this->binned[sig].row(bam_idx);
+			binSignals(signals,(int)this->binned_min.cols(),this->smooth_factor,this->cap_depth,
+				this->binned_min.row(bam_idx),this->binned_max.row(bam_idx),bam_signals);
+			bam->approximate = false;
+			signals.clear();
+			});
+		}
+	}
+
+/** fill 'approx' with the density of the reads of each bam in 'n_bins' columns covering the contig of the current
+ * region or the whole genome, from the indexes only. The density of a column is the difference between the compressed
+ * offsets of the first reads at its two boundaries (see BamW::indexOffset), per base, divided by the mean of the bam.
+ * The resolution is the 16kb window of the linear index. The contigs are those of the first bam.
+ */
+void X11BamCov::indexDensity(int n_bins) {
+	ChromStartEnd* rgn = this->regions->get(this->region_idx);
+	ostringstream os;
+	os << this->approx_mode << "\t" << (this->approx_mode==APPROX_CHROM?rgn->chrom:string("*")) << "\t" << n_bins;
+	if(os.str()==this->approx_key && this->approx.rows()==this->bams.size()) return;
+	this->approx_key.assign(os.str());
+	this->approx_segments.clear();
+	this->approx.resize(this->bams.size(),n_bins);
+	const BamW* first = NULL;
+	for(auto bam: this->bams) if(!bam->isRemote()) { first = bam; break;}
+	if(first==NULL) {
+		cerr << "[WARN] the approximate view needs the bam indexes: it is not available with a coverage server." << endl;
+		return;
+		}
+	const bam_hdr_t* hdr = first->header->hdr;
+	if(this->approx_mode==APPROX_CHROM) {
+		int tid = first->header->nameToTid(rgn->chrom);
+		if(tid>=0) {
+			ApproxSegment seg = {string(hdr->target_name[tid]),(int)hdr->target_len[tid],0,n_bins};
+			this->approx_segments.push_back(seg);
+			}
+		}
+	else
 		{
-		string ctg2 = rgn->chrom.substr(3);
-		tid = ::bam_name2id(bam->hdr, ctg2.c_str());
+		int64_t genome_length = 0;
+		for(int tid=0;tid< hdr->n_targets;tid++) genome_length += hdr->target_len[tid];
+		int64_t cumul = 0;
+		for(int tid=0;tid< hdr->n_targets && genome_length>0;tid++) {
+			int col0 = (int)((cumul*n_bins)/genome_length);
+			cumul += hdr->target_len[tid];
+			int col1 = (int)((cumul*n_bins)/genome_length);
+			// contigs smaller than a column are not drawn
+			if(col1<=col0) continue;
+			ApproxSegment seg = {string(hdr->target_name[tid]),(int)hdr->target_len[tid],col0,col1-col0};
+			this->approx_segments.push_back(seg);
+			}
 		}
-	if(tid<0 && !starts_with(rgn->chrom,"chr"))
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	this->pool.run(this->bams.size(),[&](size_t bam_idx,int) {
+		BamW* bam = this->bams[bam_idx];
+		if(bam->isRemote()) return;
+		float* row = this->approx.row(bam_idx);
+		double sum = 0.0;
+		int n = 0;
+		for(auto& seg: this->approx_segments) {
+			int tid = bam->header->nameToTid(seg.chrom);
+			if(tid<0) continue;
+			const double col_length = seg.length/(double)seg.n_cols;
+			int64_t prev = bam->indexOffset(tid,0);
+			for(int j=0;j< seg.n_cols;j++) {
+				int pos = (int)std::min((int64_t)seg.length-1,((int64_t)(j+1)*seg.length)/seg.n_cols);
+				int64_t off = bam->indexOffset(tid,pos);
+				// no read at the boundary: the bytes are given to the next column having one
+				if(off<0 || prev<0) {
+					if(off>=0) prev = off;
+					continue;
+					}
+				row[seg.col0+j] = (float)(std::max((int64_t)0,off-prev)/col_length);
+				prev = off;
+				if(row[seg.col0+j]>0.0f) {
+					sum += row[seg.col0+j];
+					n++;
+					}
+				}
+			}
+		if(n==0) return;
+		const float inv_mean = (float)(n/sum);
+		for(size_t i=0;i< this->approx.cols();i++) row[i] *= inv_mean;
+		});
+	cerr << "[INFO] approximate view of " << this->bams.size() << " bam(s) from the indexes in "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count() << " ms." << endl;
+	}
+
+/** draw the approximate view computed by indexDensity */
+void X11BamCov::paintApprox() {
+	GC gc = ::XCreateGC(this->display, this->window, 0, 0);
+	XSetForeground(this->display, gc, WhitePixel(this->display, this->screen_number));
+	::XFillRectangle(this->display,this->window, gc,0,0,this->window_width,this->window_height);
+	{
+	ostringstream os;
+	os << "APPROXIMATE density of the reads from the indexes: ";
+	if(this->approx_mode==APPROX_CHROM) {
+		os << (this->approx_segments.empty()?string("?"):this->approx_segments[0].chrom) << " (whole chromosome)";
+		}
+	else
 		{
-		string ctg2 = "chr";
-		ctg2.append(rgn->chrom);
-		tid = ::bam_name2id(bam->hdr, ctg2.c_str());
+		os << "whole genome";
+		}
+	os << ". 1=mean of the sample";
+	string title = os.str();
+	XStoreName(this->display,this->window,title.c_str());
+	int title_width= title.size()*12;
+	XSetForeground(this->display, gc, palette->red.pixel);
+	hershey.paint(this->display,this->window, gc,title.c_str(),
+			this->window_width/2 - title_width/2,
+			1,
+			title_width,
+			MARGIN_TOP-2
+			);
+	}
+	const double vmax = 3.0;
+	for(size_t bam_idx=0;bam_idx< this->bams.size() && bam_idx< this->approx.rows();++bam_idx) {
+		BamW* bam = this->bams[bam_idx];
+		const float* values = this->approx.row(bam_idx);
+		#define VALUE_TO_Y(v) (bam->bounds.y + bam->bounds.height - (std::min(vmax,(double)(v))/vmax) * bam->bounds.height)
+		// contigs
+		XSetForeground(this->display, gc,palette->gray(0.8).pixel);
+		for(auto& seg: this->approx_segments) {
+			int x = bam->bounds.x+seg.col0;
+			if(seg.col0>0) XDrawLine(this->display, this->window, gc, x, bam->bounds.y, x, bam->bounds.y+bam->bounds.height);
+			}
+		for(int r=1;r< (int)vmax;r++) {
+			int y = (int)VALUE_TO_Y(r);
+			XDrawLine(this->display, this->window, gc, (int)bam->bounds.x, y,(int)(bam->bounds.x+bam->bounds.width), y);
+			}
+		vector<XPoint> points;
+		XPoint pt1={(pixel_t)bam->bounds.x,(pixel_t)VALUE_TO_Y(0)};
+		points.push_back(pt1);
+		for(size_t i=0;i< this->approx.cols();i++) {
+			XPoint pt = {(pixel_t)(bam->bounds.x+i),(pixel_t)VALUE_TO_Y(values[i])};
+			points.push_back(pt);
+			}
+		XPoint pt2={(pixel_t)(bam->bounds.x+bam->bounds.width),(pixel_t)VALUE_TO_Y(0)};
+		points.push_back(pt2);
+		XSetForeground(this->display, gc,palette->gray(0.5).pixel);
+		::XFillPolygon(this->display,this->window, gc, &points[0], (int)points.size(), Complex,CoordModeOrigin);
+		#undef VALUE_TO_Y
+		// names of the contigs wide enough
+		XSetForeground(this->display, gc,palette->gray(0.3).pixel);
+		for(auto& seg: this->approx_segments) {
+			if(seg.n_cols < 8*(int)seg.chrom.size() || bam->bounds.height< 30) continue;
+			hershey.paint(this->display,this->window, gc,seg.chrom.c_str(),
+				bam->bounds.x+seg.col0+1,
+				bam->bounds.y+bam->bounds.height-9,
+				7*(int)seg.chrom.size(),
+				7
+				);
+			}
+		if(this->show_sample_name) {
+			XSetForeground(this->display, gc, palette->gray(0.1).pixel);
+			hershey.paint(this->display,this->window, gc,bam->sample.c_str(),
+				bam->bounds.x,
+				bam->bounds.y+1,
+				std::min((int)bam->bounds.width,12*(int)bam->sample.size()),
+				std::min(20,(int)(bam->bounds.height/10))
+				);
+			}
+		XSetForeground(this->display, gc, palette->red.pixel);
+		::XDrawRectangle(this->display,this->window, gc,bam->bounds.x,bam->bounds.y,bam->bounds.width,bam->bounds.height);
 		}
+	flushPaint();
+	XFreeGC(this->display,gc);
+	}
 
-	if(tid<0) {
-		bam->bad_flag = true;
-		cerr << "[WARN] No chromosome " << rgn->chrom << " in "<< bam ->filename << endl;
-		continue;
+/** true if a key was pressed and is not handled yet */
+bool X11BamCov::keyPending() {
+	if(this->has_deadline && std::chrono::steady_clock::now() >= this->deadline) return true;
+	XEvent evt;
+	if(!::XCheckTypedWindowEvent(this->display,this->window,KeyPress,&evt)) return false;
+	::XPutBackEvent(this->display,&evt);
+	return true;
+	}
+
+/** replace the previews by the exact signals, one panel at a time. Stops as soon as a key is pressed,
+ * the main loop calls it again once the key is handled. The scale of the panels is kept until all of them are exact.
+ */
+void X11BamCov::refine() {
+	if(!this->refining) return;
+	ChromStartEnd* rgn = this->regions->get(this->region_idx);
+	GC gc = ::XCreateGC(this->display, this->window, 0, 0);
+	const double max_signal = maxEventSignal();
+	bool done = true;
+	for(size_t bam_idx=0;bam_idx< this->bams.size();++bam_idx) {
+		BamW* bam = this->bams[bam_idx];
+		if(!bam->approximate) continue;
+		if(keyPending()) {
+			done = false;
+			break;
+			}
+		// the samples of a file are read together
+		std::vector<size_t> same_file;
+		// scale of the panels, set by paint()
+		std::vector<double> shown_depth;
+		for(size_t i=bam_idx;i< this->bams.size();++i) {
+			if(this->bams[i]->file!=bam->file || !this->bams[i]->approximate) continue;
+			same_file.push_back(i);
+			shown_depth.push_back(this->bams[i]->max_depth);
+			}
+		loadBinned(same_file,rgn);
+		updateCohortRows(same_file);
+		for(size_t k=0;k< same_file.size();++k) {
+			BamW* panel = this->bams[same_file[k]];
+			// a preview never exceeds the exact max depth, so the last paint() gets the exact scale
+			double exact_depth = panel->max_depth;
+			panel->max_depth = shown_depth[k];
+			paintBam(gc,same_file[k],rgn,max_signal);
+			panel->max_depth = std::max(shown_depth[k],exact_depth);
+			}
+		XFlush(this->display);
 		}
-		
-	hts_itr_t *iter = ::sam_itr_queryi(bam->idx, tid,rgn->start,rgn->end);
-	while ((ret = bam_itr_next(bam->fp, iter, b)) >= 0)
+	XFreeGC(this->display,gc);
+	if(done) {
+		this->refining = false;
+		computeCohortTrack();
+		paint();
+		if(this->timed_refining) {
+			this->timed_refining = false;
+			this->refined_latencies[this->timed_key].push_back(std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-this->timed_received).count());
+			}
+		}
+	}
+
+/** key of the signals of 'bam' over 'rgn', drawn in 'n_bins' columns, in the coverage cache */
+std::string X11BamCov::cacheKey(const BamW* bam,const ChromStartEnd* rgn,int n_bins) const {
+	ostringstream os;
+	os << bam->cache_id << "\t" << rgn->chrom << ":" << rgn->start << "-" << rgn->end
+		<< "\tfilter:" << this->filter.exclude_flags
+		<< "\tlow_mapq:" << this->low_mapq;
+	if(this->filter.require_flags!=0) os << "\trequire:" << this->filter.require_flags;
+	if(this->filter.min_mapq>0) os << "\tmin_mapq:" << this->filter.min_mapq;
+	if(this->filter.min_base_qual>0) os << "\tmin_base_qual:" << this->filter.min_base_qual;
+	// the saturating count depends on the columns
+	if(this->saturate_depth && this->cap_depth>0) os << "\tsaturate:" << this->cap_depth << "\tcolumns:" << n_bins;
+	return os.str();
+	}
+
+#define SIGNAL_CHUNK_LENGTH 100000
+
+/** add the base-level signals of a chunk starting at 'offset' in the region to 'signals', see BamW::fetchSignals */
+static void addChunk(std::vector<RunLengthCoverage>& signals,const std::vector<RunLengthCoverage>& chunk,size_t offset) {
+	signals.resize(NUM_SIGNALS);
+	for(int sig=0;sig< NUM_SIGNALS;sig++) signals[sig].add(chunk[sig],offset);
+	}
+
+/** run-length encode the base-level signals 'dense' of a chunk */
+static void encodeChunk(const std::vector<std::vector<int> >& dense,std::vector<RunLengthCoverage>& chunk) {
+	chunk.resize(NUM_SIGNALS);
+	for(int sig=0;sig< NUM_SIGNALS;sig++) chunk[sig].encode(&dense[sig][0],dense[sig].size());
+	}
+
+/** get the base-level signals of 'rgn', drawn in 'n_bins' columns, from the cache, or from the bam and then store them in the cache.
+ * The bam is read by chunks of SIGNAL_CHUNK_LENGTH bases, so only one chunk is decoded at a time.
+ */
+void X11BamCov::loadSignals(BamW* bam,int tid,const ChromStartEnd* rgn,int n_bins,bam1_t* b,std::vector<RunLengthCoverage>& signals) {
+	string key;
+	signals.assign(NUM_SIGNALS,RunLengthCoverage());
+	if(this->cache!=NULL) {
+		key = cacheKey(bam,rgn,n_bins);
+		if(this->cache->load(key,signals)) return;
+		signals.assign(NUM_SIGNALS,RunLengthCoverage());
+		}
+	std::vector<std::vector<int> > dense;
+	std::vector<RunLengthCoverage> chunk;
+	std::unique_ptr<Saturation> saturation(bam->newSaturation(rgn->length(),n_bins));
+	for(int start=rgn->start;start<= rgn->end;start+=SIGNAL_CHUNK_LENGTH) {
 		{
-		const bam1_core_t *c = &b->core;
-		if ( c->flag & (BAM_FUNMAP | BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP) ) continue;
-		
-		uint32_t *cigar = bam_get_cigar(b);
-		if(cigar==NULL) continue;
-		
-		int ref1 = c->pos + 1;
-		
-		for (unsigned int icig=0; icig< c->n_cigar && ref1 < rgn->end; icig++)
-	    		{
-			int op  = bam_cigar_opchr(cigar[icig]);
-			int len = bam_cigar_oplen(cigar[icig]);
-			    
-		    	switch(op)
-		    		{
-		    		case 'P': break;
-		    		case 'I': break;
-		    		case 'D': case 'N' : ref1+=len; break;
-		    		case 'S': case 'H':break;
-		    		case 'M': case '=' : case 'X':
-		    			{
-		    			for(int x=0;x< len && ref1 < rgn->end ;++x) {
-		    				int idx1 = ref1 - rgn->start;
-						ref1++;
-		    				if(idx1< 0 || idx1 >= (int)coverage.size()) continue;
-						coverage[idx1]++;
-						bam->max_depth = std::max(bam->max_depth,(double)coverage[idx1]);
-		    				}
-		    			break;
-		    			}
-		    		default: cerr << "boum ??" <<(char) op<<" " <<(char) BAM_CMATCH << endl;break;
-		    		}
+		std::lock_guard<std::mutex> guard(bam->file->lock);
+		bam->fetchSignals(bam->fp,tid,rgn,start,std::min(rgn->end,start+SIGNAL_CHUNK_LENGTH-1),b,dense,saturation.get());
+		}
+		encodeChunk(dense,chunk);
+		addChunk(signals,chunk,start-rgn->start);
+		}
+	if(this->cache!=NULL) this->cache->save(key,signals);
+	}
+
+#define MERGE_MAX_LENGTH 10000000
+/** a region read once from a file for one or more jobs, see loadSignals(std::vector<SignalJob>&) */
+struct SignalSpan
+	{
+	BamW* file;
+	int tid;
+	ChromStartEnd rgn;
+	/** columns of the jobs, with the saturating count */
+	int n_bins;
+	/** the chunks of the span in loadSignals */
+	size_t first_chunk;
+	size_t n_chunks;
+	/** the jobs cut from this span */
+	std::vector<size_t> jobs;
+	/** signals of each sample of the file, see BamW::fetchSamples */
+	std::vector<std::vector<RunLengthCoverage> > samples;
+	};
+
+/** fill the signals of each job like loadSignals, on all the threads of 'pool'.
+ * The jobs missing from the cache are sorted by file, contig and start. The jobs of the samples of a multi-sample
+ * file over the same region share a span, read once for all of them (see BamW::fetchSamples). With merge_distance>=0,
+ * the regions of a file overlapping or closer than merge_distance are also merged into a span of at most MERGE_MAX_LENGTH
+ * bases. The signals of each job are then cut from those of its span. The jobs keep their order.
+ * The spans are split in chunks of SIGNAL_CHUNK_LENGTH bases; each thread reads its chunks with its own handle on the file,
+ * the index being shared, and encodes them. The chunks of each span are then added in order. A single bam over a large
+ * region is then read by all the threads. The handles of the threads are kept open between calls, see ThreadHandles.
+ * With the saturating count (see Saturation), the spans are only shared by jobs over the same region and columns,
+ * and the chunks of a span are read in order by the same thread.
+ */
+void X11BamCov::loadSignals(std::vector<SignalJob>& jobs) {
+	const int n_threads = this->pool.size();
+	std::vector<std::string> keys(jobs.size());
+	std::vector<char> cached(jobs.size(),0);
+	if(this->cache!=NULL) {
+		this->pool.run(jobs.size(),[&](size_t i,int) {
+			keys[i] = cacheKey(this->bams[jobs[i].bam_idx],jobs[i].rgn,jobs[i].n_bins);
+			jobs[i].signals.resize(NUM_SIGNALS);
+			cached[i] = this->cache->load(keys[i],jobs[i].signals);
+			});
+		}
+	std::vector<size_t> missing;
+	for(size_t i=0;i< jobs.size();i++) {
+		if(!cached[i]) missing.push_back(i);
+		}
+	std::sort(missing.begin(),missing.end(),[&](size_t a,size_t b) {
+		const SignalJob& ja = jobs[a];
+		const SignalJob& jb = jobs[b];
+		const BamW* fa = this->bams[ja.bam_idx]->file;
+		const BamW* fb = this->bams[jb.bam_idx]->file;
+		if(fa!=fb) return std::less<const BamW*>()(fa,fb);
+		if(ja.tid!=jb.tid) return ja.tid < jb.tid;
+		if(ja.rgn->start!=jb.rgn->start) return ja.rgn->start < jb.rgn->start;
+		return a < b;
+		});
+	const bool saturating = (this->saturate_depth && this->cap_depth>0);
+	std::vector<SignalSpan> spans;
+	for(size_t k=0;k< missing.size();k++) {
+		const SignalJob& job = jobs[missing[k]];
+		BamW* file = this->bams[job.bam_idx]->file;
+		if(!spans.empty()) {
+			SignalSpan& last = spans.back();
+			if(last.file==file && last.tid==job.tid && (this->merge_distance>=0 && !saturating ?
+				job.rgn->start <= last.rgn.end + this->merge_distance + 1 && std::max(last.rgn.end,job.rgn->end) - last.rgn.start < MERGE_MAX_LENGTH :
+				job.rgn->start==last.rgn.start && job.rgn->end==last.rgn.end && (!saturating || job.n_bins==last.n_bins))) {
+				last.rgn.end = std::max(last.rgn.end,job.rgn->end);
+				last.jobs.push_back(missing[k]);
+				continue;
+				}
 			}
+		spans.push_back(SignalSpan());
+		spans.back().file = file;
+		spans.back().tid = job.tid;
+		spans.back().rgn = *job.rgn;
+		spans.back().n_bins = job.n_bins;
+		spans.back().jobs.push_back(missing[k]);
 		}
-	::hts_itr_destroy(iter);
-	if(this->cap_depth>0) bam->max_depth=std::min(bam->max_depth,(double)this->cap_depth);
-
-	int smooth=0;
-	if(smooth_factor>1) smooth = (int)(coverage.size()/(double)this->smooth_factor);
-	if(smooth>0) {
-		vector<int> smoothed;
-		smoothed.resize(coverage.size(),0);
-		std::fill(smoothed.begin(),smoothed.end(),0);
-		for(int i=0;i< (int)coverage. size();i++)
+	// (span, start of chunk), the chunks of a span are consecutive
+	std::vector<std::pair<size_t,int> > chunks;
+	for(size_t i=0;i< spans.size();i++) {
+		const ChromStartEnd* rgn = &spans[i].rgn;
+		spans[i].first_chunk = chunks.size();
+		for(int start=rgn->start;start<= rgn->end;start+=SIGNAL_CHUNK_LENGTH) {
+			chunks.push_back(make_pair(i,start));
+			}
+		spans[i].n_chunks = chunks.size() - spans[i].first_chunk;
+		}
+	if(this->pool_handles.size()< (size_t)n_threads) this->pool_handles.resize(n_threads);
+	std::vector<std::vector<std::vector<std::vector<int> > > > scratch(n_threads);
+	// encoded[chunk][sample]
+	std::vector<std::vector<std::vector<RunLengthCoverage> > > encoded(chunks.size());
+	auto read_chunk = [&](size_t c,int t,Saturation* saturation) {
+		SignalSpan& span = spans[chunks[c].first];
+		const ChromStartEnd* rgn = &span.rgn;
+		BamW* file = span.file;
+		ThreadHandles& handles = this->pool_handles[t];
+		if(handles.b==NULL) handles.b = ::bam_init1();
+		samFile* in = handles.get(file);
+		const int chunk_start = chunks[c].second;
+		const int chunk_end = std::min(rgn->end,chunk_start+SIGNAL_CHUNK_LENGTH-1);
+		std::vector<std::vector<std::vector<int> > >& local = scratch[t];
+		if(in!=NULL) {
+			file->fetchSamples(in,span.tid,rgn,chunk_start,chunk_end,handles.b,local,saturation);
+			}
+		else
 			{
-			double total=0;
-			int count=0;
-			for(int j=std::max(0,i-smooth);j<i+smooth;++j)
-				{
-				if(j<0 || j>= (int)coverage.size()) continue;
-				total +=  coverage[j];
-				count++;
+			// no more file descriptors ? use the handle of the bam
+			std::lock_guard<std::mutex> guard(file->lock);
+			file->fetchSamples(file->fp,span.tid,rgn,chunk_start,chunk_end,handles.b,local,saturation);
+			}
+		encoded[c].resize(local.size());
+		for(size_t i=0;i< local.size();i++) encodeChunk(local[i],encoded[c][i]);
+		};
+	if(saturating) {
+		// the saturation is carried from chunk to chunk
+		this->pool.run(spans.size(),[&](size_t i,int t) {
+			const SignalSpan& span = spans[i];
+			std::unique_ptr<Saturation> saturation(span.file->newSaturation(span.rgn.length(),span.n_bins));
+			for(size_t c=span.first_chunk;c< span.first_chunk+span.n_chunks;c++) read_chunk(c,t,saturation.get());
+			});
+		}
+	else
+		{
+		this->pool.run(chunks.size(),[&](size_t c,int t) {
+			read_chunk(c,t,NULL);
+			});
+		}
+	for(size_t c=0;c< chunks.size();c++) {
+		SignalSpan& span = spans[chunks[c].first];
+		span.samples.resize(encoded[c].size());
+		for(size_t i=0;i< encoded[c].size();i++) {
+			addChunk(span.samples[i],encoded[c][i],chunks[c].second-span.rgn.start);
+			}
+		std::vector<std::vector<RunLengthCoverage> >().swap(encoded[c]);
+		}
+	for(size_t i=0;i< spans.size();i++) {
+		SignalSpan& span = spans[i];
+		for(size_t j: span.jobs) {
+			SignalJob& job = jobs[j];
+			std::vector<RunLengthCoverage>& signals = span.samples[std::max(0,this->bams[job.bam_idx]->rg_sample)];
+			if(span.jobs.size()==1) {
+				job.signals.swap(signals);
+				continue;
+				}
+			job.signals.resize(NUM_SIGNALS);
+			for(int sig=0;sig< NUM_SIGNALS;sig++) {
+				job.signals[sig].assign(signals[sig],job.rgn->start - span.rgn.start,job.rgn->length());
 				}
-			if(count==0) continue;
-			smoothed[i]=(int)(total/count);
 			}
-		for(int i=0;i< (int)coverage. size();i++)
-			{
-			coverage[i]=smoothed[i];
+		span.samples.clear();
+		}
+	if(this->cache!=NULL) {
+		for(size_t i=0;i< jobs.size();i++) {
+			if(!cached[i]) this->cache->save(keys[i],jobs[i].signals);
 			}
 		}
+	}
 
-	for(int i=0;i< (int)bam->coverage.size();i++)
-		{
-		int g1 = (i/(double)bam->coverage.size())*coverage.size();
-		int g2 = ((i+1)/(double)bam->coverage.size())*coverage.size();
-		double total=0;
-		int count=0;
-		for(int x=g1;x<=g2 && x < (int)coverage.size();++x)
+/** compare each bam to the median of the cohort, bin by bin. The depth of each bam is first
+ * normalized by its library size. The bams flagged as unreadable are left out of the median and the MAD.
+ * The spread used for the z-score is 1.4826*MAD, but at least 1.
+ * The GC correction, if any, is updated first.
+ */
+void X11BamCov::computeCohortTrack() {
+	// nothing was binned yet if the first views were approximate
+	if(this->binned.empty()) return;
+	computeGCCorrection();
+	if(this->track_mode==TRACK_DEPTH) return;
+	std::vector<float> scales;
+	// the bams that could not be read are not part of the cohort
+	std::vector<char> valid;
+	for(auto bam: this->bams) {
+		scales.push_back(bam->scale);
+		valid.push_back(bam->bad_flag?0:1);
+		}
+	const CoverageMatrix& current = currentSignal();
+	current.columnMedianMAD(scales,this->cohort_median,this->cohort_mad,this->cohort_scratch,&valid[0]);
+	std::vector<float>& inv_spread = this->cohort_inv_spread;
+	inv_spread.assign(current.cols(),0.0f);
+	for(size_t j=0;j< inv_spread.size();j++) {
+		float spread;
+		if(this->track_mode==TRACK_RATIO) {
+			spread = this->cohort_median[j];
+			}
+		else
 			{
-			total+= coverage[x];
-			count++;
+			spread = std::max(1.4826f*this->cohort_mad[j],1.0f);
 			}
-		if(count==0) continue;
-		bam->coverage[i]= total/count;
-		if(this->cap_depth>0) bam->coverage[i] = std::min(bam->coverage[i],(float)this->cap_depth);
+		inv_spread[j] = (spread>0.0f?1.0f/spread:0.0f);
 		}
+	current.standardize(scales,this->cohort_median,inv_spread,this->cohort_track);
 	}
-::bam_destroy1(b);
 
-paint();
-}
+/** the binned values of the current signal, corrected for the GC content if asked */
+const CoverageMatrix& X11BamCov::currentSignal() const {
+	if(this->gc_correction && this->signal==SIGNAL_DEPTH && !this->gc_content.empty()) return this->gc_corrected;
+	return this->binned[this->signal];
+	}
+
+#define GC_MIN_BINS 10
+/** correct the binned depth of each bam for the GC content of the bins, see correctGC */
+void X11BamCov::computeGCCorrection() {
+	if(!this->gc_correction || this->gc_content.empty()) return;
+	const CoverageMatrix& depth = this->binned[SIGNAL_DEPTH];
+	this->gc_corrected.resize(depth.rows(),depth.cols());
+	vector<float> scratch;
+	for(size_t i=0;i< depth.rows();i++) {
+		correctGC(depth.row(i),&this->gc_content[0],depth.cols(),GC_MIN_BINS,this->gc_corrected.row(i),scratch);
+		}
+	}
+
+/** update the GC correction and the cohort track of the bams 'bam_idxs' only, against the current median and spread
+ * of the cohort: the rows of a file refined by refine(). The median is updated by computeCohortTrack once all are refined.
+ */
+void X11BamCov::updateCohortRows(const std::vector<size_t>& bam_idxs) {
+	if(this->binned.empty()) return;
+	if(this->gc_correction && !this->gc_content.empty()) {
+		const CoverageMatrix& depth = this->binned[SIGNAL_DEPTH];
+		if(this->gc_corrected.rows()!=depth.rows() || this->gc_corrected.cols()!=depth.cols()) {
+			computeCohortTrack();
+			return;
+			}
+		vector<float> scratch;
+		for(size_t bam_idx: bam_idxs) {
+			correctGC(depth.row(bam_idx),&this->gc_content[0],depth.cols(),GC_MIN_BINS,this->gc_corrected.row(bam_idx),scratch);
+			}
+		}
+	if(this->track_mode==TRACK_DEPTH) return;
+	const CoverageMatrix& current = currentSignal();
+	if(this->cohort_track.rows()!=current.rows() || this->cohort_track.cols()!=current.cols() || this->cohort_inv_spread.size()!=current.cols()) {
+		computeCohortTrack();
+		return;
+		}
+	for(size_t bam_idx: bam_idxs) {
+		current.standardizeRow(bam_idx,this->bams[bam_idx]->scale,this->cohort_median,this->cohort_inv_spread,this->cohort_track);
+		}
+	}
+
+/** fill gc_content with the GC fraction of each of the 'n_bins' bins of 'rgn'. The reference is only
+ * read the first time a region is seen with this number of bins, whatever the number of bams.
+ */
+void X11BamCov::gcContent(const ChromStartEnd* rgn,int n_bins) {
+	this->gc_content.clear();
+	if(this->reference==NULL) return;
+	ostringstream os;
+	os << rgn->chrom << ":" << rgn->start << "-" << rgn->end << "/" << n_bins;
+	string key(os.str());
+	auto r = this->gc_cache.find(key);
+	if(r!=this->gc_cache.end()) {
+		this->gc_content = r->second;
+		return;
+		}
+	string chrom(rgn->chrom);
+	if(!::faidx_has_seq(this->reference,chrom.c_str())) {
+		chrom = (starts_with(chrom,"chr")?chrom.substr(3):"chr"+chrom);
+		}
+	int len = 0;
+	char* seq = ::faidx_fetch_seq(this->reference,chrom.c_str(),rgn->start-1,rgn->end-1,&len);
+	this->gc_content.assign(n_bins,-1.0f);
+	if(seq==NULL || len<=0) {
+		cerr << "[WARN] Cannot fetch " << rgn->chrom << ":" << rgn->start << "-" << rgn->end << " from the reference." << endl;
+		}
+	else
+		{
+		binGC(seq,(size_t)len,(size_t)n_bins,&this->gc_content[0]);
+		}
+	free(seq);
+	if(this->gc_cache.size()>=1000) this->gc_cache.clear();
+	this->gc_cache[key] = this->gc_content;
+	}
 
 void X11BamCov::resized() {
 	//int x,y,wr;
@@ -582,6 +2552,471 @@ void X11BamCov::resized() {
 	}
 
 
+/** open each bam of the file 'bam_list' and compute the library size factors */
+bool X11BamCov::loadBams(const char* bam_list) {
+	ifstream bamin(bam_list);
+	if(!bamin.is_open()) {
+		cerr << "Cannot open " << bam_list << endl;
+		return false;
+		}
+	this->io_start = IOCounters::current();
+	string line;
+	while(getline(bamin,line)) {
+		if(line.empty() || line[0]=='#') continue;
+		BamW* bamFile	 = new BamW(this,line);
+		if(bamFile->panels.empty()) {
+			this->bams.push_back(bamFile);
+			}
+		else
+			{
+			// one panel per sample of the read groups
+			this->bams.insert(this->bams.end(),bamFile->panels.begin(),bamFile->panels.end());
+			}
+		}
+	bamin.close();
+	if(this->bams.empty()) {
+		cerr << "List of bams is empty." << endl;
+		return false;
+		}
+	normalizeLibrarySizes();
+	return true;
+	}
+
+/** normalize each bam to the mean library size */
+void X11BamCov::normalizeLibrarySizes() {
+	uint64_t total_mapped = 0UL;
+	size_t n_mapped = 0;
+	for(auto bam: this->bams) {
+		if(bam->mapped_reads==0UL) continue;
+		total_mapped += bam->mapped_reads;
+		n_mapped++;
+		}
+	for(auto bam: this->bams) {
+		if(bam->mapped_reads==0UL) continue;
+		bam->scale = (float)((total_mapped/(double)n_mapped)/bam->mapped_reads);
+		}
+	}
+
+#define CALL_BINS 20
+#define CALL_BATCH 64
+#define CALL_MIN_DEPTH 5.0f
+#define CALL_DEL_RATIO 0.65f
+#define CALL_DUP_RATIO 1.35f
+/** without display: score each region for each bam and write the likely deletions and duplications to 'filename' ('-' for stdout).
+ * Each region is binned in CALL_BINS bins like the panels of repaint(), the bins are divided by the median of the cohort,
+ * and a bam is called when the median ratio of the bins having a cohort depth of at least CALL_MIN_DEPTH
+ * is below CALL_DEL_RATIO or above CALL_DUP_RATIO. The regions are processed by batches of CALL_BATCH, the bams of MAX_JOB_FILES
+ * files at a time (see batchByFile), each bam x region being read on all the threads of 'pool' (see loadSignals). The calls are written in the order of
+ * the regions: chrom, start (0-based), end, sample, DEL/DUP, ratio, label; the first three columns are those of option -o.
+ */
+int X11BamCov::callCNVs(const char* filename) {
+	FILE* out = (strcmp(filename,"-")==0?stdout:fopen(filename,"w"));
+	if(out==NULL) {
+		cerr << "Cannot open " << filename << ". " << ::strerror(errno) << endl;
+		return EXIT_FAILURE;
+		}
+	if(this->bams.size()< 3) {
+		cerr << "[WARN] only " << this->bams.size() << " bam(s): the cohort median is not meaningful." << endl;
+		}
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	const size_t n_bams = this->bams.size();
+	std::vector<float> scales;
+	for(auto bam: this->bams) scales.push_back(bam->scale);
+	size_t n_calls = 0;
+	std::vector<std::vector<size_t> > bam_batches;
+	{
+	std::vector<size_t> all_bams(n_bams);
+	for(size_t i=0;i< n_bams;i++) all_bams[i] = i;
+	batchByFile(all_bams,bam_batches);
+	}
+	for(size_t batch_start=0;batch_start< this->regions->size();batch_start+=CALL_BATCH) {
+		// copy the regions: the pointer returned by RegionSource::get is not shared between threads
+		std::vector<ChromStartEnd> batch;
+		for(size_t i=batch_start;i< std::min(this->regions->size(),batch_start+CALL_BATCH);i++) {
+			ChromStartEnd rgn = *(this->regions->get(i));
+			// score the interval of the bed file, not the extended one
+			rgn.start = rgn.original_start;
+			rgn.end = rgn.original_end;
+			batch.push_back(rgn);
+			}
+		// one samples x bins matrix per region; 'valid' is false if the contig is missing in the bam
+		std::vector<CoverageMatrix> depths(batch.size());
+		for(auto& m: depths) m.resize(n_bams,CALL_BINS);
+		std::vector<char> valid(batch.size()*n_bams,0);
+		for(const std::vector<size_t>& bam_batch: bam_batches) {
+			// (region, bam) of the jobs
+			std::vector<std::pair<size_t,size_t> > specs;
+			for(size_t bam_idx: bam_batch) {
+				for(size_t r=0;r< batch.size();r++) {
+					if(batch[r].tid<0 || this->bams[bam_idx]->header->region2tid[batch[r].tid]<0) continue;
+					specs.push_back(make_pair(r,bam_idx));
+					}
+				}
+			std::vector<SignalJob> jobs(specs.size());
+			for(size_t j=0;j< jobs.size();j++) {
+				jobs[j].bam_idx = specs[j].second;
+				jobs[j].rgn = &batch[specs[j].first];
+				jobs[j].n_bins = CALL_BINS;
+				jobs[j].tid = this->bams[jobs[j].bam_idx]->header->region2tid[jobs[j].rgn->tid];
+				}
+			loadSignals(jobs);
+			this->pool.run(jobs.size(),[&](size_t j,int) {
+				const size_t r = specs[j].first;
+				const size_t bam_idx = specs[j].second;
+				float bam_min[CALL_BINS],bam_max[CALL_BINS];
+				float other[NUM_SIGNALS][CALL_BINS];
+				float* bam_signals[NUM_SIGNALS];
+				for(int sig=0;sig< NUM_SIGNALS;sig++) bam_signals[sig] = other[sig];
+				bam_signals[SIGNAL_DEPTH] = depths[r].row(bam_idx);
+				binSignals(jobs[j].signals,CALL_BINS,this->smooth_factor,this->cap_depth,bam_min,bam_max,bam_signals);
+				jobs[j].signals.clear();
+				valid[r*n_bams+bam_idx] = 1;
+				});
+			}
+
+		std::vector<float> median,mad,scratch,ratios;
+		for(size_t r=0;r< batch.size();r++) {
+			const ChromStartEnd& rgn = batch[r];
+			const CoverageMatrix& depth = depths[r];
+			// the bams lacking the contig are not part of the cohort
+			depth.columnMedianMAD(scales,median,mad,scratch,&valid[r*n_bams]);
+			for(size_t bam_idx=0;bam_idx< n_bams;bam_idx++) {
+				if(!valid[r*n_bams+bam_idx]) continue;
+				ratios.clear();
+				for(size_t j=0;j< depth.cols();j++) {
+					if(median[j]< CALL_MIN_DEPTH) continue;
+					ratios.push_back(depth.get(bam_idx,j)*scales[bam_idx]/median[j]);
+					}
+				if(ratios.empty()) continue;
+				std::nth_element(ratios.begin(),ratios.begin()+ratios.size()/2,ratios.end());
+				float ratio = ratios[ratios.size()/2];
+				const char* type = (ratio< CALL_DEL_RATIO?"DEL":(ratio> CALL_DUP_RATIO?"DUP":NULL));
+				if(type==NULL) continue;
+				fprintf(out,"%s\t%d\t%d\t%s\t%s\t%.3f\t%s\n",
+					rgn.chrom.c_str(),
+					rgn.original_start-1,
+					rgn.original_end,
+					this->bams[bam_idx]->sample.c_str(),
+					type,
+					ratio,
+					(rgn.label.empty()?".":rgn.label.c_str())
+					);
+				n_calls++;
+				}
+			}
+		}
+	fflush(out);
+	if(out!=stdout) fclose(out);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	cerr << "[INFO] " << n_calls << " call(s) in " << this->regions->size() << " region(s) x " << n_bams << " bam(s) in "
+		<< seconds << " seconds using " << this->pool.size() << " thread(s)." << endl;
+	return 0;
+	}
+
+#define THUMB_BINS PREVIEW_SAMPLES
+#define THUMB_CELL_WIDTH 160
+#define THUMB_CELL_HEIGHT 90
+#define MAX_THUMBNAILS 1000
+/** mean depth of each bam over 'rgn' in THUMB_BINS columns, NaN for the bams that cannot be read. The regions longer than
+ * preview_length are sampled like X11BamCov::sampleSignals, one window per column, so the thumbnail can replace their preview,
+ * see thumbnailPreview. Runs on the thumbnail thread, with its own 'handles' on the files (see ThreadHandles).
+ */
+void X11BamCov::computeThumbnail(const ChromStartEnd& rgn,ThreadHandles& handles,std::vector<float>& values) {
+	values.assign(this->bams.size()*THUMB_BINS,NAN);
+	const bool sampled = (this->preview_length>0 && rgn.length()>this->preview_length);
+	std::vector<std::vector<std::vector<int> > > samples;
+	std::vector<RunLengthCoverage> coverage,chunk;
+	for(size_t bam_idx=0;bam_idx< this->bams.size();++bam_idx) {
+		BamW* bam = this->bams[bam_idx];
+		// the samples of a file are filled with its first panel
+		if(bam->isRemote() || bam->rg_sample>0) continue;
+		int tid = (rgn.tid<0?-1:bam->header->region2tid[rgn.tid]);
+		if(tid<0) continue;
+		samFile* in = handles.get(bam);
+		if(in==NULL) continue;
+		bam1_t* b = handles.b;
+		// rows of the panels of this file, by sample
+		const size_t n_samples = (bam->panels.empty()?1:bam->panels.size());
+		std::vector<float*> rows(n_samples,(float*)NULL);
+		for(size_t i=bam_idx;i< this->bams.size();++i) {
+			if(this->bams[i]->file==bam) rows[std::max(0,this->bams[i]->rg_sample)] = &values[i*THUMB_BINS];
+			}
+		coverage.assign(n_samples,RunLengthCoverage());
+		chunk.resize(n_samples);
+		if(sampled) {
+			ChromStartEnd w;
+			w.chrom = rgn.chrom;
+			w.tid = rgn.tid;
+			for(int k=0;k< THUMB_BINS;k++) {
+				int64_t center = rgn.start + ((int64_t)(2*k+1)*rgn.length())/(2*THUMB_BINS);
+				w.start = std::max(rgn.start,(int)(center - PREVIEW_WINDOW/2));
+				w.end = std::min(rgn.end,w.start + PREVIEW_WINDOW - 1);
+				std::unique_ptr<Saturation> saturation(bam->newSaturation(w.length(),1));
+				bam->fetchSamples(in,tid,&w,w.start,w.end,b,samples,saturation.get());
+				for(size_t i=0;i< n_samples;i++) {
+					if(rows[i]==NULL) continue;
+					coverage[i].encode(&samples[i][SIGNAL_DEPTH][0],samples[i][SIGNAL_DEPTH].size());
+					coverage[i].bin(1,NULL,&rows[i][k],NULL);
+					}
+				}
+			}
+		else
+			{
+			std::unique_ptr<Saturation> saturation(bam->newSaturation(rgn.length(),THUMB_BINS));
+			for(int start=rgn.start;start<= rgn.end;start+=SIGNAL_CHUNK_LENGTH) {
+				bam->fetchSamples(in,tid,&rgn,start,std::min(rgn.end,start+SIGNAL_CHUNK_LENGTH-1),b,samples,saturation.get());
+				for(size_t i=0;i< n_samples;i++) {
+					if(rows[i]==NULL) continue;
+					chunk[i].encode(&samples[i][SIGNAL_DEPTH][0],samples[i][SIGNAL_DEPTH].size());
+					coverage[i].add(chunk[i],start-rgn.start);
+					}
+				}
+			for(size_t i=0;i< n_samples;i++) {
+				if(rows[i]!=NULL) coverage[i].bin(THUMB_BINS,NULL,rows[i],NULL);
+				}
+			}
+		if(this->cap_depth>0) {
+			for(size_t i=0;i< n_samples;i++) {
+				if(rows[i]==NULL) continue;
+				for(int k=0;k< THUMB_BINS;k++) rows[i][k] = std::min(rows[i][k],(float)this->cap_depth);
+				}
+			}
+		}
+	}
+
+/** body of the thumbnail thread: compute the thumbnails of thumb_queue at the lowest priority, and send a ClientMessage
+ * to the window, through its own connection to the display, when new thumbnails can be drawn.
+ */
+void X11BamCov::thumbnailLoop() {
+#ifdef __linux__
+	// the nice value of this thread only
+	::setpriority(PRIO_PROCESS,(id_t)::syscall(SYS_gettid),19);
+#endif
+	Display* dpy = ::XOpenDisplay(NULL);
+	// at most MAX_JOB_FILES open files, like the threads of the pool
+	ThreadHandles handles;
+	handles.b = ::bam_init1();
+	for(;;) {
+		std::pair<size_t,ChromStartEnd> job;
+		{
+		std::unique_lock<std::mutex> guard(this->thumb_lock);
+		this->thumb_cond.wait(guard,[this]{ return this->thumb_stop || !this->thumb_queue.empty();});
+		if(this->thumb_stop) break;
+		job = this->thumb_queue.front();
+		this->thumb_queue.pop_front();
+		if(this->thumbnails.find(job.first)!=this->thumbnails.end()) continue;
+		}
+		std::vector<float> values;
+		computeThumbnail(job.second,handles,values);
+		{
+		std::lock_guard<std::mutex> guard(this->thumb_lock);
+		if(this->thumbnails.size()>=MAX_THUMBNAILS) {
+			// the least recently used thumbnail outside of the visible and the next page
+			auto oldest = this->thumbnails.end();
+			for(auto r=this->thumbnails.begin();r!=this->thumbnails.end();++r) {
+				if(r->first>=this->thumb_keep_first && r->first< this->thumb_keep_end) continue;
+				if(oldest==this->thumbnails.end() || r->second.last_use< oldest->second.last_use) oldest = r;
+				}
+			if(oldest!=this->thumbnails.end()) this->thumbnails.erase(oldest);
+			}
+		Thumbnail& thumbnail = this->thumbnails[job.first];
+		thumbnail.values.swap(values);
+		thumbnail.last_use = ++this->thumb_clock;
+		}
+		if(dpy!=NULL && !this->thumb_notified.exchange(true)) {
+			XEvent evt;
+			memset(&evt,0,sizeof(XEvent));
+			evt.xclient.type = ClientMessage;
+			evt.xclient.window = this->window;
+			evt.xclient.format = 32;
+			::XSendEvent(dpy,this->window,False,NoEventMask,&evt);
+			::XFlush(dpy);
+			}
+		}
+	handles.close();
+	if(dpy!=NULL) ::XCloseDisplay(dpy);
+	}
+
+/** stop and join the thumbnail thread, if any */
+void X11BamCov::stopThumbnails() {
+	if(!this->thumb_thread.joinable()) return;
+	{
+	std::lock_guard<std::mutex> guard(this->thumb_lock);
+	this->thumb_stop = true;
+	}
+	this->thumb_cond.notify_all();
+	this->thumb_thread.join();
+	}
+
+/** lay out the page of the overview holding the current region, queue the missing thumbnails of this page then of the next one, and draw it */
+void X11BamCov::repaintOverview() {
+	this->overview_cols = std::max(1,this->window_width/THUMB_CELL_WIDTH);
+	this->overview_rows = std::max(1,(this->window_height-MARGIN_TOP)/THUMB_CELL_HEIGHT);
+	const size_t page = this->overview_cols*this->overview_rows;
+	this->overview_first = (this->region_idx/page)*page;
+	{
+	std::lock_guard<std::mutex> guard(this->thumb_lock);
+	this->thumb_keep_first = this->overview_first;
+	this->thumb_keep_end = std::min(this->regions->size(),this->overview_first+2*page);
+	this->thumb_queue.clear();
+	for(size_t i=this->thumb_keep_first;i< this->thumb_keep_end;i++) {
+		if(this->thumbnails.find(i)!=this->thumbnails.end()) continue;
+		this->thumb_queue.push_back(make_pair(i,*(this->regions->get(i))));
+		}
+	}
+	this->thumb_cond.notify_one();
+	if(!this->thumb_thread.joinable()) {
+		this->thumb_thread = std::thread(&X11BamCov::thumbnailLoop,this);
+		}
+	this->refining = false;
+	paint();
+	}
+
+/** draw the page of the overview: for each region, the depth of each sample divided by the median of the samples,
+ * from 0 to 2. The samples whose median ratio would be called by option -c are drawn in red (deletion) or blue (duplication).
+ */
+void X11BamCov::paintOverview() {
+	GC gc = ::XCreateGC(this->display, this->window, 0, 0);
+	XSetForeground(this->display, gc, WhitePixel(this->display, this->screen_number));
+	::XFillRectangle(this->display,this->window, gc,0,0,this->window_width,this->window_height);
+	const size_t page = this->overview_cols*this->overview_rows;
+	const size_t last = std::min(this->regions->size(),this->overview_first+page);
+	{
+	ostringstream os;
+	os << "OVERVIEW regions " << niceInt(this->overview_first+1) << "-" << niceInt(last) << "/" << niceInt(this->regions->size())
+		<< ". depth/median of the samples. click a region.";
+	string title = os.str();
+	XStoreName(this->display,this->window,title.c_str());
+	int title_width= title.size()*12;
+	XSetForeground(this->display, gc, BlackPixel(this->display, this->screen_number));
+	hershey.paint(this->display,this->window, gc,title.c_str(),
+			this->window_width/2 - title_width/2,
+			1,
+			title_width,
+			MARGIN_TOP-2
+			);
+	}
+	const int cell_w = this->window_width/this->overview_cols;
+	const int cell_h = (this->window_height-MARGIN_TOP)/this->overview_rows;
+	const size_t n_bams = this->bams.size();
+	std::vector<float> median(THUMB_BINS),column,ratios;
+	std::vector<XPoint> points;
+	std::lock_guard<std::mutex> guard(this->thumb_lock);
+	for(size_t idx=this->overview_first;idx< last;idx++) {
+		const int x0 = ((idx-this->overview_first)%this->overview_cols)*cell_w;
+		const int y0 = MARGIN_TOP + ((idx-this->overview_first)/this->overview_cols)*cell_h;
+		const int label_h = 10;
+		const int plot_y = y0 + label_h + 2;
+		const int plot_h = cell_h - label_h - 4;
+		{
+		ChromStartEnd* rgn = this->regions->get(idx);
+		ostringstream os;
+		os << rgn->chrom << ":" << niceInt(rgn->start);
+		string label = os.str();
+		XSetForeground(this->display, gc, palette->gray(0.2).pixel);
+		hershey.paint(this->display,this->window, gc,label.c_str(),x0+2,y0+1,std::min(cell_w-4,7*(int)label.size()),label_h-2);
+		}
+		auto r = this->thumbnails.find(idx);
+		if(r==this->thumbnails.end() || plot_h< 2) {
+			XSetForeground(this->display, gc, palette->gray(0.8).pixel);
+			::XDrawRectangle(this->display,this->window, gc,x0+1,y0+1,cell_w-2,cell_h-2);
+			continue;
+			}
+		r->second.last_use = ++this->thumb_clock;
+		const std::vector<float>& values = r->second.values;
+		for(int k=0;k< THUMB_BINS;k++) {
+			column.clear();
+			for(size_t bam_idx=0;bam_idx< n_bams;bam_idx++) {
+				float v = values[bam_idx*THUMB_BINS+k];
+				if(!std::isnan(v)) column.push_back(v*this->bams[bam_idx]->scale);
+				}
+			if(column.empty()) { median[k]=0.0f; continue;}
+			std::nth_element(column.begin(),column.begin()+column.size()/2,column.end());
+			median[k] = column[column.size()/2];
+			}
+		#define RATIO_TO_Y(v) (plot_y + plot_h - (int)((std::min(2.0f,(v))/2.0f) * plot_h))
+		XSetForeground(this->display, gc, palette->gray(0.85).pixel);
+		XDrawLine(this->display, this->window, gc, x0, RATIO_TO_Y(1.0f), x0+cell_w, RATIO_TO_Y(1.0f));
+		// the normal samples first, so the outliers are drawn on top
+		for(int pass=0;pass< 2;pass++) {
+			for(size_t bam_idx=0;bam_idx< n_bams;bam_idx++) {
+				const float* row = &values[bam_idx*THUMB_BINS];
+				if(std::isnan(row[0])) continue;
+				const float scale = this->bams[bam_idx]->scale;
+				ratios.clear();
+				for(int k=0;k< THUMB_BINS;k++) {
+					if(median[k]>=CALL_MIN_DEPTH) ratios.push_back(row[k]*scale/median[k]);
+					}
+				float call = 1.0f;
+				if(!ratios.empty()) {
+					std::nth_element(ratios.begin(),ratios.begin()+ratios.size()/2,ratios.end());
+					call = ratios[ratios.size()/2];
+					}
+				const bool outlier = (call< CALL_DEL_RATIO || call> CALL_DUP_RATIO);
+				if(outlier != (pass==1)) continue;
+				XSetForeground(this->display, gc, (call< CALL_DEL_RATIO?palette->red.pixel:(call> CALL_DUP_RATIO?palette->blue.pixel:palette->gray(0.5).pixel)));
+				points.clear();
+				for(int k=0;k< THUMB_BINS;k++) {
+					float ratio = (median[k]>0.0f?row[k]*scale/median[k]:1.0f);
+					XPoint pt = {(pixel_t)(x0 + (k*cell_w)/THUMB_BINS),(pixel_t)RATIO_TO_Y(ratio)};
+					points.push_back(pt);
+					}
+				::XDrawLines(this->display,this->window, gc,&points[0],(int)points.size(),CoordModeOrigin);
+				}
+			}
+		#undef RATIO_TO_Y
+		XSetForeground(this->display, gc, (idx==this->region_idx?palette->red.pixel:palette->gray(0.6).pixel));
+		::XDrawRectangle(this->display,this->window, gc,x0+1,y0+1,cell_w-2,cell_h-2);
+		}
+	flushPaint();
+	XFreeGC(this->display,gc);
+	}
+
+/** use the thumbnail of the current region, if any, as the preview of the depth of 'bam_idx' in 'n_bins' columns instead of
+ * X11BamCov::sampleSignals: the thumbnail of a long region holds the same samples. The envelope is the mean, the other signals are 0.
+ */
+bool X11BamCov::thumbnailPreview(size_t bam_idx,int n_bins) {
+	if(this->signal!=SIGNAL_DEPTH) return false;
+	std::lock_guard<std::mutex> guard(this->thumb_lock);
+	auto r = this->thumbnails.find(this->region_idx);
+	if(r==this->thumbnails.end()) return false;
+	r->second.last_use = ++this->thumb_clock;
+	const float* row = &(r->second.values[bam_idx*THUMB_BINS]);
+	if(std::isnan(row[0])) return false;
+	BamW* bam = this->bams[bam_idx];
+	bam->max_depth = 1.0;
+	for(int i=0;i< n_bins;i++) {
+		const float v = row[((int64_t)i*THUMB_BINS)/n_bins];
+		for(int sig=0;sig< NUM_SIGNALS;sig++) this->binned[sig].row(bam_idx)[i] = (sig==SIGNAL_DEPTH?v:0.0f);
+		this->binned_min.row(bam_idx)[i] = v;
+		this->binned_max.row(bam_idx)[i] = v;
+		bam->max_depth = std::max(bam->max_depth,(double)v);
+		}
+	bam->approximate = true;
+	return true;
+	}
+
+/** set region_idx to the first region overlapping or following 'chrom:pos' */
+bool X11BamCov::gotoPosition(const char* s) {
+	string str(s);
+	string::size_type colon = str.find(':');
+	string chrom = str.substr(0,colon);
+	int pos = 1;
+	try {
+		if(colon!=string::npos) pos = parseInt(str.substr(colon+1).c_str());
+		}
+	catch(std::exception& err) {
+		return false;
+		}
+	size_t idx;
+	if(!regions->find(chrom.c_str(),pos,&idx)) {
+		cerr << "[WARN] no region at or after " << s << endl;
+		return false;
+		}
+	this->region_idx = idx;
+	return true;
+	}
+
 void X11BamCov::usage(std::ostream& out)
 	{
 	out << "cnv" << endl;
@@ -593,13 +3028,37 @@ void X11BamCov::usage(std::ostream& out)
 	out << "  'R'/'T' change column number\n";
 	out << "  'Q'/'Esc' exit\n";
 	out << "  'N' toggle show/hide sample name\n";
+	out << "  'K' cycle the signal: depth, forward strand depth, reverse strand depth, low MAPQ depth, clipped reads, split reads\n";
+	out << "  'E' toggle show/hide the min/max envelope of the depth\n";
+	out << "  'M' cycle display mode: depth, ratio to the cohort median, z-score against the cohort median/MAD\n";
+	out << "  'C' toggle the correction of the depth for the GC content (needs option -r)\n";
+	out << "  'A' cycle the approximate view, drawn from the bam indexes without reading the bams: off, chromosome of the current region, whole genome\n";
+	out << "  'O' toggle the overview: a grid of thumbnails of the regions, filled in the background, showing the depth of each sample relative to the median of the samples. Click a thumbnail to view its region. Not available with -S.\n";
+	out << "  'G' go to the interval overlapping a position typed in the terminal (chrom:pos). The window is still drawn while typing. Needs stdin to be a terminal, see -g otherwise.\n";
 	out << "Options:\n";
 	out << "  -h print help and exit\n";
 	out << "  -v print version and exit\n";
 	out << "  -o (FILE) save BED segment in that bed file (use key 'S')\n";
-	out << "  -D (int) cap depth to that value. Negative=ignore [-1]\n";
+	out << "  -D (int) cap the depth of each base to that value, before the binning and the smoothing. Negative=ignore [-1]\n";
+	out << "  -e with -D, skip the reads whose columns of the drawing all reached the cap for their strand (like 'samtools depth -d' but per column). Faster on ultra-deep data, and draws the same picture since the depth is capped at each base. The clipped/split reads are always counted.\n";
 	out << "  -B (FILE) list of path to indexed bam files\n";
-	out << "  -R (FILE) bed file of regions of interest. optional 4th column is used as a label\n";
+	out << "  -R (FILE) bed file of regions of interest. optional 4th column is used as a label. If the file ends with '.gz', it must be bgzipped and indexed with tabix; regions are then loaded on demand.\n";
+	out << "  -x (FLAGS) skip the reads having any of these flags, as a number or names like 'samtools view -F'. [" << filter.exclude_flags << "]\n";
+	out << "  -i (FLAGS) skip the reads not having all of these flags, e.g. 'PROPER_PAIR'. [" << filter.require_flags << "]\n";
+	out << "  -q (int) skip the reads with a MAPQ lower than this value. [" << filter.min_mapq << "]\n";
+	out << "  -Q (int) don't count the aligned bases with a base quality lower than this value in the depth. [" << filter.min_base_qual << "]\n";
+	out << "  -l (int) reads with a MAPQ lower than this value are counted in the 'low MAPQ' signal. [" << low_mapq << "]\n";
+	out << "  -S (FILE) get the bams and their coverage from the server listening on this unix socket (see 'x11hts serve') instead of -B. The reads are then counted by the server, so -l, -e, -x, -i, -q and -Q cannot be used, and the overview (key 'O') is not available.\n";
+	out << "  -C (DIR) cache the base-level coverage of each bam and region in this directory, to be reused by the next sessions.\n";
+	out << "  -c (FILE) don't open a display: call the deletions and duplications of each region and bam, relative to the cohort median, and write them to FILE ('-' for stdout) as bed: chrom, start, end, sample, DEL/DUP, ratio, label.\n";
+	out << "  -t (int) number of threads reading the bams. [" << pool.size() << "]\n";
+	out << "  -J (int) with -c, the regions of a batch overlapping or closer than this distance are read at once from each bam, and each region is cut from their union. Useful for clustered region lists. -1: never. [" << merge_distance << "]\n";
+	out << "  -a (int) prefetch the compressed blocks of each query of the local bams, coalescing the chunks of the index closer than this size (KB), and read the bams by blocks of this size. Prints the I/O statistics at exit. 0: only print the statistics. -1: off. [" << readahead_kb << "]\n";
+	out << "  -r (FILE) indexed reference of the bams: the GC content of the bins is drawn in each panel, see key 'C'.\n";
+	out << "  -p (int) regions longer than this are first drawn from a sample of the reads, then refined panel by panel. 0=never. [" << preview_length << "]\n";
+	out << "  -L (FILE) record the keys in this script, with their time since the first paint, and print the latency of each key at exit.\n";
+	out << "  -P (FILE) replay a script recorded with -L, then exit and print the latency of each key: from the key press (or its time in the script) to its first drawing (the preview), and to the end of the refinement. The drawing of a key is interrupted when the next one is due.\n";
+	out << "  -g (chrom:pos) start with the first region overlapping or following this position.\n";
 	out << "  -f (float) extend the regions by this factor. e.g: 0.3 [" << extend_factor << "]\n";
         out << "  -s (int) smooth factor. Smooth using a sliding window of 'region-length'/'s'. 0=ignore. [" << smooth_factor<<"]\n";
 	}
@@ -608,6 +3067,13 @@ int X11BamCov::doWork(int argc,char** argv) {
 	char* bam_list = NULL;
 	char* region_list = NULL;
 	char *file_out = NULL;
+	char *goto_pos = NULL;
+	char *socket_path = NULL;
+	char *calls_out = NULL;
+	char *record_out = NULL;
+	char *replay_in = NULL;
+	// options changing how the reads are counted: a coverage server uses its own
+	string read_options;
 	int opt;
 	
 	if(argc<=1) {
@@ -615,7 +3081,7 @@ int X11BamCov::doWork(int argc,char** argv) {
 		return EXIT_FAILURE;
 		}
 
-	while ((opt = getopt(argc, argv, "B:R:f:D:o:vhs:")) != -1) {
+	while ((opt = getopt(argc, argv, "B:R:f:D:o:vhs:g:C:l:S:p:r:c:t:eL:P:J:a:x:i:q:Q:")) != -1) {
 		switch (opt) {
 		case 'h':
 			usage(cout);
@@ -641,6 +3107,69 @@ int X11BamCov::doWork(int argc,char** argv) {
 		case 's': 
 			this->smooth_factor = atof(optarg);
 			break;
+		case 'g':
+			goto_pos = optarg;
+			break;
+		case 'l':
+			this->low_mapq = parseInt(optarg);
+			read_options.push_back(opt);
+			break;
+		case 'S':
+			socket_path = optarg;
+			break;
+		case 'p':
+			this->preview_length = parseInt(optarg);
+			break;
+		case 'c':
+			calls_out = optarg;
+			break;
+		case 'e':
+			this->saturate_depth = true;
+			read_options.push_back(opt);
+			break;
+		case 'J':
+			this->merge_distance = parseInt(optarg);
+			break;
+		case 'a':
+			this->readahead_kb = parseInt(optarg);
+			break;
+		case 'x':
+			this->filter.exclude_flags = parseFlags(optarg);
+			read_options.push_back(opt);
+			break;
+		case 'i':
+			this->filter.require_flags = parseFlags(optarg);
+			read_options.push_back(opt);
+			break;
+		case 'q':
+			this->filter.min_mapq = parseInt(optarg);
+			read_options.push_back(opt);
+			break;
+		case 'Q':
+			this->filter.min_base_qual = parseInt(optarg);
+			read_options.push_back(opt);
+			break;
+		case 'L':
+			record_out = optarg;
+			break;
+		case 'P':
+			replay_in = optarg;
+			break;
+		case 't':
+			this->pool = WorkStealingPool(parseInt(optarg));
+			break;
+		case 'r':
+			if(this->reference!=NULL) ::fai_destroy(this->reference);
+			this->reference = ::fai_load(optarg);
+			if(this->reference==NULL) {
+				cerr << "Cannot load the faidx index of " << optarg << endl;
+				return EXIT_FAILURE;
+				}
+			break;
+		case 'C':
+			if(this->cache!=NULL) delete this->cache;
+			this->cache = new CoverageCache(optarg);
+			break;
 		case '?':
 			cerr << "unknown option -"<< (char)optopt << endl;
 			return EXIT_FAILURE;
@@ -654,25 +3183,28 @@ int X11BamCov::doWork(int argc,char** argv) {
 		return EXIT_FAILURE;
 		}
 	//
-	if(bam_list == NULL) {
-		cerr << "List of bams is undefined." << endl;
-		return EXIT_FAILURE;
-		}
-	ifstream bamin(bam_list);
-	if(!bamin.is_open()) {
-		cerr << "Cannot open " << bam_list << endl;
-		return EXIT_FAILURE;
-		}
-	string line;
-	while(getline(bamin,line)) {
-		if(line.empty() || line[0]=='#') continue;
-		BamW* bamFile	 = new BamW(this,line);
-		this->bams.push_back(bamFile);
+	if(socket_path != NULL) {
+		if(bam_list != NULL) {
+			cerr << "Options -B and -S are mutually exclusive." << endl;
+			return EXIT_FAILURE;
+			}
+		if(!read_options.empty()) {
+			cerr << "Option -" << read_options[0] << " cannot be used with -S: the reads are counted by the server, set it with 'x11hts serve'." << endl;
+			return EXIT_FAILURE;
+			}
+		if(!connectServer(socket_path)) {
+			return EXIT_FAILURE;
+			}
 		}
-	bamin.close();
-	if(this->bams.empty()) {
-		cerr << "List of bams is empty." << endl;
-		return EXIT_FAILURE;
+	else
+		{
+		if(bam_list == NULL) {
+			cerr << "List of bams is undefined." << endl;
+			return EXIT_FAILURE;
+			}
+		if(!loadBams(bam_list)) {
+			return EXIT_FAILURE;
+			}
 		}
 	this->num_columns = (int)std::ceil(::sqrt(this->bams.size()));
 	if( this->num_columns <= 0 ) this->num_columns = 1;
@@ -683,41 +3215,54 @@ int X11BamCov::doWork(int argc,char** argv) {
 		cerr << "List of regions is undefined." << endl;
 		return EXIT_FAILURE;
 		}
-	ifstream regionin(region_list);
-	if(!regionin.is_open()) {
-		cerr << "Cannot open " << region_list << endl;
-		return EXIT_FAILURE;
+	if(ends_with(region_list,".gz")) {
+		this->regions = new TabixRegionSource(region_list,this->extend_factor);
 		}
-	while(getline(regionin,line)) {
-		if(line.empty() || line[0]=='#') continue;
-		ChromStartEnd* rgn	 = new ChromStartEnd(line);
-		if(this->extend_factor != 0.0)
-			{
-			int L = rgn->length();
-			int L2 = (int)(L*(1.0+extend_factor));
-			int mid = rgn->start + L/2;
-			rgn->start = std::max(1,mid - L2);
-			rgn->end = mid + L2;
-			//cerr << "[DEBUG]" << rgn->start << "-" << rgn->end  << endl;
-			}
-
-		this->regions.push_back(rgn);
+	else
+		{
+		this->regions = new RegionTable(region_list,this->extend_factor);
 		}
-	regionin.close();
-	if(this->regions.empty()) {
+	if(this->regions->size()==0UL) {
 		cerr << "[FAILURE] List of regions is empty." << endl;
 		return EXIT_FAILURE;
 		}
+	for(auto header: this->headers) {
+		header->mapContigs(this->regions->getContigs());
+		}
+	cerr << "[INFO] " << this->bams.size() << " bam(s) share " << this->headers.size() << " distinct header(s)." << endl;
+	if(goto_pos!=NULL && !gotoPosition(goto_pos)) {
+		return EXIT_FAILURE;
+		}
+	if(calls_out!=NULL) {
+		if(socket_path!=NULL) {
+			cerr << "Option -c needs the bams (-B), not a server (-S)." << endl;
+			return EXIT_FAILURE;
+			}
+		int ret = callCNVs(calls_out);
+		if(this->readahead_kb>=0) printIOStats(cerr);
+		return ret;
+		}
 	//
-	FILE* saveOut=NULL;
 	if(file_out!=NULL)
 		{
-		saveOut = fopen(file_out,"w");
-		if(saveOut==NULL) {
+		this->save_out = fopen(file_out,"w");
+		if(this->save_out==NULL) {
 			cerr << "Cannot open " << file_out << endl;
 			return EXIT_FAILURE;			
 			}
 		}
+	std::vector<ScriptAction> script;
+	if(replay_in!=NULL && !loadScript(replay_in,script)) {
+		return EXIT_FAILURE;
+		}
+	if(record_out!=NULL) {
+		this->record_out = fopen(record_out,"w");
+		if(this->record_out==NULL) {
+			cerr << "Cannot open " << record_out << endl;
+			return EXIT_FAILURE;
+			}
+		fprintf(this->record_out,"#milliseconds\tkey\targument\n");
+		}
 
 	//
 	this->display = ::XOpenDisplay(NULL);
@@ -744,73 +3289,730 @@ int X11BamCov::doWork(int argc,char** argv) {
 			 WhitePixel(display,  this->screen_number)
 			 );
 
-	::XSelectInput(display, window, ExposureMask | KeyPressMask);
+	::XSelectInput(display, window, ExposureMask | KeyPressMask | ButtonPressMask);
 	::XMapWindow(display, window);
 	//main loop
 	XEvent evt;
 	bool done=false;
+	// the session starts with the first paint: the times of the script are relative to it
+	bool started = false;
+	size_t script_idx = 0;
 	while(!done) {
-		::XNextEvent(this->display, &evt);
-		if(evt.type ==  KeyPress)
-			{
-			if (evt.xkey.keycode == XKeysymToKeycode(this->display, XK_Q) ||
-				evt.xkey.keycode == XKeysymToKeycode(this->display, XK_Escape))
-				{
-				done = true;
+		if(started && script_idx< script.size() && ::XPending(this->display)==0) {
+			const ScriptAction& action = script[script_idx++];
+			std::chrono::steady_clock::time_point due = this->session_start + std::chrono::milliseconds(action.ms);
+			// the previews are refined until the action is due, as if the user was waiting
+			this->deadline = due;
+			this->has_deadline = true;
+			while(std::chrono::steady_clock::now() < due) {
+				if(this->refining) {
+					refine();
+					}
+				else
+					{
+					std::this_thread::sleep_for(std::min(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(10)),due - std::chrono::steady_clock::now()));
+					}
 				}
-			else if (evt.xkey.keycode == XKeysymToKeycode(this->display, XK_Left))
-				{
-				region_idx = (region_idx==0UL?regions.size()-1:region_idx-1);
-				repaint();
+			// the drawing of this action is interrupted when the next one is due, as if the user pressed it
+			if(script_idx< script.size()) {
+				this->deadline = this->session_start + std::chrono::milliseconds(script[script_idx].ms);
 				}
-			else if (evt.xkey.keycode == XKeysymToKeycode(this->display, XK_Right))
+			else
 				{
-				region_idx = (region_idx+1>=regions.size()?0:region_idx+1);
-				repaint();
+				this->has_deadline = false;
 				}
-			else if (evt.xkey.keycode == XKeysymToKeycode(this->display, XK_S) && saveOut!=NULL)
-				{
-				ChromStartEnd* rgn = this->regions[this->region_idx];
-				fprintf(saveOut,"%s\t%d\t%d\n",
-					rgn->chrom.c_str(),
-					rgn->original_start-1,
-					rgn->original_end
-					);
-				cerr << "[INFO] SAVED" << endl;
+			KeySym key = ::XStringToKeysym(action.key.c_str());
+			if(key==NoSymbol) {
+				cerr << "[WARN] unknown key in script: " << action.key << endl;
 				}
-			else if (evt.xkey.keycode == XKeysymToKeycode(this->display, XK_R) && num_columns>1)
+			else
 				{
-				num_columns--;
-				repaint();
+				string arg(action.arg);
+				done = (timedKey(::XKeysymToKeycode(this->display,key),action.key,arg,std::chrono::steady_clock::now())<0);
 				}
-			else if (evt.xkey.keycode == XKeysymToKeycode(this->display, XK_T) && num_columns+1<= (int)this->bams.size())
-				{
-				num_columns++;
-				repaint();
+			if(script_idx==script.size()) {
+				// the refinement of the last action is timed too
+				while(!done && this->refining && !keyPending()) refine();
+				done = true;
 				}
-			else if (evt.xkey.keycode == XKeysymToKeycode(this->display, XK_N))
-				{
-				show_sample_name = !show_sample_name;
+			continue;
+			}
+		if(this->goto_prompt && ::XPending(this->display)==0) {
+			string arg;
+			if(readPosition(arg)) {
+				done = (timedKey(::XKeysymToKeycode(this->display,XK_G),::XKeysymToString(XK_g),arg,std::chrono::steady_clock::now())<0);
+				}
+			continue;
+			}
+		::XNextEvent(this->display, &evt);
+		if(evt.type ==  KeyPress)
+			{
+			std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now();
+			const char* name = ::XKeysymToString(::XLookupKeysym(&evt.xkey,0));
+			string arg;
+			done = (timedKey(evt.xkey.keycode,(name==NULL?"?":name),arg,received)<0);
+			}
+		else if(evt.type == ButtonPress && this->overview)
+			{
+			// jump to the region of the thumbnail
+			int col = evt.xbutton.x / std::max(1,this->window_width/this->overview_cols);
+			int row = (evt.xbutton.y - MARGIN_TOP) / std::max(1,(this->window_height-MARGIN_TOP)/this->overview_rows);
+			size_t idx = this->overview_first + row*this->overview_cols + col;
+			if(evt.xbutton.y >= MARGIN_TOP && col< this->overview_cols && row< this->overview_rows && idx< this->regions->size()) {
+				this->region_idx = idx;
+				this->overview = false;
 				repaint();
 				}
-	
-
+			}
+		else if(evt.type == ClientMessage)
+			{
+			// new thumbnails
+			this->thumb_notified = false;
+			if(this->overview) paintOverview();
 			}
 		else if(evt.type ==   Expose)
 			{
 			resized();
+			if(!started) {
+				started = true;
+				this->session_start = std::chrono::steady_clock::now();
+				}
+			}
+		if(this->refining && ::XPending(this->display)==0) {
+			refine();
 			}
 		}//end while
 
+	stopThumbnails();
 	::XCloseDisplay(display);
 	display=NULL;
-	if(saveOut!=NULL)
+	if(this->save_out!=NULL)
 		{
-		fclose(saveOut);
+		fclose(this->save_out);
+		this->save_out=NULL;
 		}
+	if(this->record_out!=NULL)
+		{
+		fclose(this->record_out);
+		this->record_out=NULL;
+		}
+	if(replay_in!=NULL || record_out!=NULL) {
+		printLatencies(cerr,"first drawing (preview)",this->latencies);
+		printLatencies(cerr,"end of the refinement",this->refined_latencies);
+		}
+	if(this->readahead_kb>=0) printIOStats(cerr);
 	return 0;
 	}
 
+/** handle a key, see handleKey, and record its latency: from 'received' to its first drawing, usually the preview. The key 'G'
+ * without a position only asks for it: the main loop calls timedKey again once it is typed.
+ * The end of the refinement, if any, is recorded by refine(). The key is written in the script if recording.
+ */
+int X11BamCov::timedKey(unsigned int keycode,const std::string& name,std::string& arg,std::chrono::steady_clock::time_point received) {
+	// the position of 'G' is typed in the terminal while the window keeps being drawn, see readPosition.
+	// The key is handled, and timed, once the position is read
+	if(arg.empty() && keycode==XKeysymToKeycode(this->display,XK_G)) {
+		if(!::isatty(STDIN_FILENO)) {
+			cerr << "[WARN] 'G' reads the position from a terminal, but stdin is not one. Use option -g." << endl;
+			return 0;
+			}
+		cerr << "[INPUT] go to (chrom:pos) ? ";
+		this->goto_prompt = true;
+		return 0;
+		}
+	this->has_timed_paint = false;
+	// the refinement of the previous key, if still running, is abandoned
+	this->timed_refining = false;
+	int ret = handleKey(keycode,arg);
+	if(ret==0) return ret;
+	::XFlush(this->display);
+	std::chrono::steady_clock::time_point painted = (this->has_timed_paint?this->timed_painted:std::chrono::steady_clock::now());
+	this->latencies[name].push_back(std::chrono::duration<double,std::milli>(painted-received).count());
+	if(this->refining) {
+		this->timed_key = name;
+		this->timed_received = received;
+		this->timed_refining = true;
+		}
+	else
+		{
+		this->refined_latencies[name].push_back(std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-received).count());
+		}
+	if(this->record_out!=NULL) {
+		fprintf(this->record_out,"%lld\t%s%s%s\n",
+			(long long)std::chrono::duration_cast<std::chrono::milliseconds>(received-this->session_start).count(),
+			name.c_str(),
+			(arg.empty()?"":"\t"),
+			arg.c_str()
+			);
+		fflush(this->record_out);
+		}
+	return ret;
+	}
+
+/** perform the action of a key. 'arg' is the position of the key 'G', see timedKey.
+ * Return 0 if the key has no action, -1 to quit, 1 otherwise.
+ */
+int X11BamCov::handleKey(unsigned int keycode,std::string& arg) {
+	if (keycode == XKeysymToKeycode(this->display, XK_Q) ||
+		keycode == XKeysymToKeycode(this->display, XK_Escape))
+		{
+		return -1;
+		}
+	else if (keycode == XKeysymToKeycode(this->display, XK_Left))
+		{
+		region_idx = (region_idx==0UL?regions->size()-1:region_idx-1);
+		repaint();
+		}
+	else if (keycode == XKeysymToKeycode(this->display, XK_Right))
+		{
+		region_idx = (region_idx+1>=regions->size()?0:region_idx+1);
+		repaint();
+		}
+	else if (keycode == XKeysymToKeycode(this->display, XK_S) && this->save_out!=NULL)
+		{
+		ChromStartEnd* rgn = this->regions->get(this->region_idx);
+		fprintf(this->save_out,"%s\t%d\t%d\n",
+			rgn->chrom.c_str(),
+			rgn->original_start-1,
+			rgn->original_end
+			);
+		cerr << "[INFO] SAVED" << endl;
+		}
+	else if (keycode == XKeysymToKeycode(this->display, XK_R) && num_columns>1)
+		{
+		num_columns--;
+		repaint();
+		}
+	else if (keycode == XKeysymToKeycode(this->display, XK_T) && num_columns+1<= (int)this->bams.size())
+		{
+		num_columns++;
+		repaint();
+		}
+	else if (keycode == XKeysymToKeycode(this->display, XK_N))
+		{
+		show_sample_name = !show_sample_name;
+		repaint();
+		}
+	else if (keycode == XKeysymToKeycode(this->display, XK_K))
+		{
+		signal = (signal+1)%NUM_SIGNALS;
+		computeCohortTrack();
+		paint();
+		}
+	else if (keycode == XKeysymToKeycode(this->display, XK_E))
+		{
+		show_envelope = !show_envelope;
+		paint();
+		}
+	else if (keycode == XKeysymToKeycode(this->display, XK_M))
+		{
+		track_mode = (track_mode+1)%NUM_TRACK_MODES;
+		computeCohortTrack();
+		paint();
+		}
+	else if (keycode == XKeysymToKeycode(this->display, XK_O))
+		{
+		// the thumbnails are computed from the bams, which the viewer cannot read with -S
+		if(this->server!=NULL) {
+			cerr << "[WARN] the overview is not available with -S." << endl;
+			return 0;
+			}
+		overview = !overview;
+		repaint();
+		}
+	else if (keycode == XKeysymToKeycode(this->display, XK_A))
+		{
+		approx_mode = (approx_mode+1)%NUM_APPROX_MODES;
+		repaint();
+		}
+	else if (keycode == XKeysymToKeycode(this->display, XK_C))
+		{
+		gc_correction = !gc_correction;
+		computeCohortTrack();
+		paint();
+		}
+	else if (keycode == XKeysymToKeycode(this->display, XK_G))
+		{
+		if(!arg.empty() && gotoPosition(arg.c_str())) repaint();
+		}
+	else
+		{
+		return 0;
+		}
+	return 1;
+	}
+
+/** wait for an X event or for the position asked by 'G' on stdin, without blocking the drawing. Return true and set 'line'
+ * once a full line is typed. At the end of stdin, the position is not asked anymore.
+ */
+bool X11BamCov::readPosition(std::string& line) {
+	const int x_fd = ConnectionNumber(this->display);
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(x_fd,&fds);
+	FD_SET(STDIN_FILENO,&fds);
+	if(::select(std::max(x_fd,STDIN_FILENO)+1,&fds,NULL,NULL,NULL)<=0 || !FD_ISSET(STDIN_FILENO,&fds)) return false;
+	char buffer[256];
+	ssize_t n = ::read(STDIN_FILENO,buffer,sizeof(buffer));
+	if(n<=0) {
+		this->goto_prompt = false;
+		this->stdin_buffer.clear();
+		cerr << endl << "[WARN] no position read from stdin." << endl;
+		return false;
+		}
+	this->stdin_buffer.append(buffer,(size_t)n);
+	size_t eol = this->stdin_buffer.find('\n');
+	if(eol==string::npos) return false;
+	line.assign(this->stdin_buffer,0,eol);
+	this->stdin_buffer.erase(0,eol+1);
+	this->goto_prompt = false;
+	return true;
+	}
+
+/** read a script written by option -L: one action per line, milliseconds since the first paint, key and optional argument */
+bool X11BamCov::loadScript(const char* filename,std::vector<ScriptAction>& script) {
+	ifstream in(filename);
+	if(!in.is_open()) {
+		cerr << "Cannot open " << filename << endl;
+		return false;
+		}
+	string line;
+	while(getline(in,line)) {
+		if(line.empty() || line[0]=='#') continue;
+		istringstream iss(line);
+		ScriptAction action;
+		string ms;
+		if(!getline(iss,ms,'\t') || !getline(iss,action.key,'\t')) {
+			cerr << "Bad line in " << filename << ": " << line << endl;
+			return false;
+			}
+		getline(iss,action.arg);
+		action.ms = strtoll(ms.c_str(),NULL,10);
+		script.push_back(action);
+		}
+	return true;
+	}
+
+/** send the drawing to the X server and remember the time of the first one after a timed key, see timedKey */
+void X11BamCov::flushPaint() {
+	XFlush(this->display);
+	if(!this->has_timed_paint) {
+		this->timed_painted = std::chrono::steady_clock::now();
+		this->has_timed_paint = true;
+		}
+	}
+
+/** print the percentiles of the latencies of each key */
+void X11BamCov::printLatencies(std::ostream& out,const char* title,std::map<std::string,std::vector<double> >& table) {
+	out << "#" << title << endl;
+	out << "#key\tcount\tp50(ms)\tp90(ms)\tp99(ms)\tmax(ms)" << endl;
+	for(auto& r: table) {
+		vector<double>& v = r.second;
+		std::sort(v.begin(),v.end());
+		auto percentile = [&v](double p) { return v[std::min(v.size()-1,(size_t)ceil(p*v.size())-(p>0.0?1:0))]; };
+		out << r.first << "\t" << v.size() << "\t" << percentile(0.5) << "\t" << percentile(0.9) << "\t" << percentile(0.99) << "\t" << v.back() << endl;
+		}
+	}
+
+/** print the prefetched ranges of the bams and the reads of the process since loadBams, see ReadAhead */
+void X11BamCov::printIOStats(std::ostream& out) {
+	uint64_t n_queries=0,n_chunks=0,n_ranges=0,n_bytes=0;
+	for(auto bam: this->bams) {
+		if(bam->file!=bam || bam->readahead==NULL) continue;
+		n_queries+=bam->readahead->n_queries;
+		n_chunks+=bam->readahead->n_chunks;
+		n_ranges+=bam->readahead->n_ranges;
+		n_bytes+=bam->readahead->n_bytes;
+		}
+	if(this->readahead_kb>0) {
+		out << "[INFO] readahead: " << n_queries << " queries, " << n_chunks << " chunks coalesced into "
+			<< n_ranges << " ranges of " << (n_ranges==0?0:n_bytes/n_ranges/1024) << " KB on average." << endl;
+		}
+	IOCounters io_end = IOCounters::current();
+	if(!this->io_start.ok || !io_end.ok) {
+		out << "[WARN] the I/O counters of the process are not available." << endl;
+		return;
+		}
+	uint64_t n_calls = io_end.read_calls - this->io_start.read_calls;
+	uint64_t n_chars = io_end.read_chars - this->io_start.read_chars;
+	out << "[INFO] I/O: " << n_calls << " read system calls, " << n_chars/1024 << " KB read ("
+		<< (n_calls==0?0:n_chars/n_calls/1024) << " KB per call), "
+		<< (io_end.storage_bytes - this->io_start.storage_bytes)/1024 << " KB from the storage." << endl;
+	}
+
+/** connect to the coverage server listening on 'socket_path' and get the list of its bams */
+bool X11BamCov::connectServer(const char* socket_path) {
+	struct sockaddr_un addr;
+	if(strlen(socket_path)>=sizeof(addr.sun_path)) {
+		cerr << "Socket path is too long: " << socket_path << endl;
+		return false;
+		}
+	int fd = ::socket(AF_UNIX,SOCK_STREAM,0);
+	if(fd<0) {
+		cerr << "Cannot create socket. " << ::strerror(errno) << endl;
+		return false;
+		}
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path,socket_path);
+	if(::connect(fd,(struct sockaddr*)&addr,sizeof(addr))!=0) {
+		cerr << "Cannot connect to " << socket_path << ". " << ::strerror(errno) << endl;
+		::close(fd);
+		return false;
+		}
+	this->server = new SocketStream(fd);
+	string line;
+	size_t n_bams = 0;
+	if(!server->write("BAMS\n") || !server->readLine(line) || sscanf(line.c_str(),"OK %zu",&n_bams)!=1) {
+		cerr << "Bad answer from " << socket_path << ": " << line << endl;
+		return false;
+		}
+	for(size_t i=0;i< n_bams;i++) {
+		if(!server->readLine(line)) return false;
+		vector<string> tokens;
+		istringstream iss(line);
+		string token;
+		while(getline(iss,token,'\t')) tokens.push_back(token);
+		if(tokens.size()!=4) {
+			cerr << "Bad answer from " << socket_path << ": " << line << endl;
+			return false;
+			}
+		this->bams.push_back(new BamW(this,tokens[3],tokens[1],strtoull(tokens[2].c_str(),NULL,10)));
+		}
+	if(this->bams.empty()) {
+		cerr << "List of bams is empty." << endl;
+		return false;
+		}
+	normalizeLibrarySizes();
+	return true;
+	}
+
+/** get the binned signals of all the bams from the coverage server, in one REGION request computed by the server
+ * on all its threads. The bams the server could not read are flagged. Return false if any.
+ */
+bool X11BamCov::fetchRemote(const ChromStartEnd* rgn,int n_bins) {
+	ostringstream os;
+	os << "REGION " << rgn->chrom << " " << rgn->start << " " << rgn->end << " "
+		<< n_bins << " " << this->smooth_factor << " " << this->cap_depth << " float32\n";
+	if(!server->write(os.str())) {
+		THROW_INVALID_ARG("Lost connection to the coverage server.");
+		}
+	bool all_ok = true;
+	for(size_t bam_idx=0;bam_idx< this->bams.size();++bam_idx) {
+		BamW* bam = this->bams[bam_idx];
+		string line;
+		if(!server->readLine(line)) {
+			THROW_INVALID_ARG("Lost connection to the coverage server.");
+			}
+		int n_rows=0,n_cols=0;
+		double max_depth=0;
+		if(sscanf(line.c_str(),"OK %d %d %lf",&n_rows,&n_cols,&max_depth)!=3 || n_rows!=NUM_SIGNALS+2 || n_cols!=n_bins) {
+			cerr << "[WARN] " << bam->sample << ": " << line << endl;
+			bam->bad_flag = true;
+			all_ok = false;
+			continue;
+			}
+		bool ok = server->read(this->binned_min.row(bam_idx),n_bins*sizeof(float));
+		for(int sig=0;ok && sig< NUM_SIGNALS;sig++) {
+			ok = server->read(this->binned[sig].row(bam_idx),n_bins*sizeof(float));
+			}
+		ok = ok && server->read(this->binned_max.row(bam_idx),n_bins*sizeof(float));
+		if(!ok) THROW_INVALID_ARG("Lost connection to the coverage server.");
+		bam->max_depth = std::max(1.0,max_depth);
+		}
+	return all_ok;
+	}
+
+/** keeps the bams, their indexes and the binned signals in memory, and serves them to the viewers
+ * ('x11hts cnv -S') on a unix socket. One request per line, fields separated by spaces:
+ *   BAMS : "OK n" then n lines "index(tab)sample(tab)mapped reads(tab)path"
+ *   SIGNALS bam_index chrom start end n_bins smooth_factor cap_depth (text|float32) :
+ *     "OK n_rows n_bins max_depth" then n_rows rows of n_bins values: the min depth, each SIGNAL_*
+ *     and the max depth. 'text' sends one tab-separated line per row, 'float32' native floats.
+ *   REGION chrom start end n_bins smooth_factor cap_depth (text|float32) :
+ *     the answer of SIGNALS for each bam, in the order of BAMS. The bams are read together on all the threads.
+ *   QUIT : closes the connection
+ * Errors are reported as "ERR message".
+ */
+class CoverageServer
+	{
+	private:
+		/** binned signals of a request */
+		struct Entry
+			{
+			double max_depth;
+			std::vector<float> values;
+			};
+		typedef std::list<std::pair<std::string,std::shared_ptr<Entry> > > lru_t;
+		/** most recently used first */
+		lru_t lru;
+		std::unordered_map<std::string,lru_t::iterator> lru_index;
+		std::mutex lru_lock;
+
+		std::shared_ptr<Entry> getEntry(const std::string& key) {
+			std::lock_guard<std::mutex> guard(lru_lock);
+			auto r = lru_index.find(key);
+			if(r==lru_index.end()) return std::shared_ptr<Entry>();
+			lru.splice(lru.begin(),lru,r->second);
+			return r->second->second;
+			}
+		void putEntry(const std::string& key,std::shared_ptr<Entry> entry) {
+			std::lock_guard<std::mutex> guard(lru_lock);
+			if(lru_index.find(key)!=lru_index.end()) return;
+			lru.push_front(make_pair(key,entry));
+			lru_index[key] = lru.begin();
+			while(lru.size()>this->max_entries) {
+				lru_index.erase(lru.back().first);
+				lru.pop_back();
+				}
+			}
+		/** one loadSignals at a time: each one runs on all the threads of the pool */
+		std::mutex compute_lock;
+
+		/** key of the binned signals of a bam in the LRU, shared by SIGNALS and REGION */
+		static std::string entryKey(size_t bam_idx,const ChromStartEnd& rgn,int n_bins,int smooth_factor,int cap_depth) {
+			ostringstream os;
+			os << bam_idx << " " << rgn.chrom << " " << rgn.start << " " << rgn.end << " " << n_bins << " " << smooth_factor << " " << cap_depth;
+			return os.str();
+			}
+		/** fill the binned signals of each bam of 'bam_idxs' over 'rgn' from the LRU, or read the missing ones together, the bams
+		 * of MAX_JOB_FILES files at a time (see X11BamCov::loadSignals(std::vector<SignalJob>&)). An entry is left empty if the
+		 * bam has no such contig.
+		 */
+		void computeEntries(const std::vector<size_t>& bam_idxs,const ChromStartEnd& rgn,int n_bins,int smooth_factor,int cap_depth,std::vector<std::shared_ptr<Entry> >& entries) {
+			entries.assign(bam_idxs.size(),std::shared_ptr<Entry>());
+			std::vector<size_t> missing;
+			// index in 'bam_idxs' of each bam
+			std::map<size_t,size_t> bam2entry;
+			std::vector<int> tids(bam_idxs.size(),-1);
+			for(size_t i=0;i< bam_idxs.size();i++) {
+				tids[i] = app.bams[bam_idxs[i]]->header->nameToTid(rgn.chrom);
+				if(tids[i]<0) continue;
+				entries[i] = getEntry(entryKey(bam_idxs[i],rgn,n_bins,smooth_factor,cap_depth));
+				if(entries[i]) continue;
+				missing.push_back(bam_idxs[i]);
+				bam2entry[bam_idxs[i]] = i;
+				}
+			std::vector<std::vector<size_t> > batches;
+			app.batchByFile(missing,batches);
+			for(const std::vector<size_t>& batch: batches) {
+				std::vector<SignalJob> jobs(batch.size());
+				for(size_t j=0;j< jobs.size();j++) {
+					jobs[j].bam_idx = batch[j];
+					jobs[j].n_bins = n_bins;
+					jobs[j].tid = tids[bam2entry[batch[j]]];
+					jobs[j].rgn = &rgn;
+					}
+				{
+				std::lock_guard<std::mutex> guard(compute_lock);
+				app.loadSignals(jobs);
+				}
+				app.pool.run(jobs.size(),[&](size_t j,int) {
+					vector<RunLengthCoverage>& signals = jobs[j].signals;
+					std::shared_ptr<Entry> entry(new Entry);
+					entry->max_depth = std::max(1.0,(double)signals[SIGNAL_DEPTH].max());
+					if(cap_depth>0) entry->max_depth = std::min(entry->max_depth,(double)cap_depth);
+					entry->values.resize((NUM_SIGNALS+2)*n_bins);
+					float* bam_signals[NUM_SIGNALS];
+					for(int sig=0;sig< NUM_SIGNALS;sig++) bam_signals[sig] = &entry->values[(1+sig)*n_bins];
+					binSignals(signals,n_bins,smooth_factor,cap_depth,&entry->values[0],&entry->values[(NUM_SIGNALS+1)*n_bins],bam_signals);
+					signals.clear();
+					entries[bam2entry.at(jobs[j].bam_idx)] = entry;
+					});
+				for(const SignalJob& job: jobs) {
+					putEntry(entryKey(job.bam_idx,rgn,n_bins,smooth_factor,cap_depth),entries[bam2entry[job.bam_idx]]);
+					}
+				}
+			}
+		/** write the answer of SIGNALS for one entry */
+		static bool writeEntry(SocketStream& io,const Entry& entry,int n_bins,const std::string& format) {
+			ostringstream os;
+			os << "OK " << (NUM_SIGNALS+2) << " " << n_bins << " " << entry.max_depth << "\n";
+			if(format=="text") {
+				for(int r=0;r< NUM_SIGNALS+2;r++) {
+					for(int i=0;i< n_bins;i++) os << (i>0?"\t":"") << entry.values[r*n_bins+i];
+					os << "\n";
+					}
+				return io.write(os.str());
+				}
+			return io.write(os.str()) && io.write(&entry.values[0],entry.values.size()*sizeof(float));
+			}
+		/** parse the region, the columns and the format of SIGNALS and REGION */
+		static bool parseRegion(istringstream& iss,ChromStartEnd& rgn,int& n_bins,int& smooth_factor,int& cap_depth,std::string& format) {
+			if(!(iss >> rgn.chrom >> rgn.start >> rgn.end >> n_bins >> smooth_factor >> cap_depth >> format) ||
+				rgn.start<1 || rgn.end<=rgn.start || rgn.length()>MAX_SERVED_LENGTH ||
+				n_bins<1 || n_bins>MAX_SERVED_BINS || (format!="text" && format!="float32")) {
+				return false;
+				}
+			rgn.tid = -1;
+			rgn.original_start = rgn.start;
+			rgn.original_end = rgn.end;
+			return true;
+			}
+		void handle(int fd) {
+			SocketStream io(fd);
+			string line;
+			while(io.readLine(line)) {
+				istringstream iss(line);
+				string cmd;
+				iss >> cmd;
+				if(cmd=="BAMS") {
+					ostringstream os;
+					os << "OK " << app.bams.size() << "\n";
+					for(size_t i=0;i< app.bams.size();i++) {
+						os << i << "\t" << app.bams[i]->sample << "\t" << app.bams[i]->mapped_reads << "\t" << app.bams[i]->filename << "\n";
+						}
+					if(!io.write(os.str())) break;
+					}
+				else if(cmd=="SIGNALS" || cmd=="REGION") {
+					std::vector<size_t> bam_idxs;
+					if(cmd=="SIGNALS") {
+						size_t bam_idx;
+						if(!(iss >> bam_idx) || bam_idx>=app.bams.size()) {
+							if(!io.write("ERR bad request\n")) break;
+							continue;
+							}
+						bam_idxs.push_back(bam_idx);
+						}
+					else
+						{
+						for(size_t i=0;i< app.bams.size();i++) bam_idxs.push_back(i);
+						}
+					ChromStartEnd rgn;
+					int n_bins,smooth_factor,cap_depth;
+					string format;
+					if(!parseRegion(iss,rgn,n_bins,smooth_factor,cap_depth,format)) {
+						if(!io.write("ERR bad request\n")) break;
+						continue;
+						}
+					std::vector<std::shared_ptr<Entry> > entries;
+					computeEntries(bam_idxs,rgn,n_bins,smooth_factor,cap_depth,entries);
+					bool ok = true;
+					for(size_t i=0;ok && i< entries.size();i++) {
+						ok = (entries[i] ? writeEntry(io,*entries[i],n_bins,format) : io.write("ERR no chromosome "+rgn.chrom+"\n"));
+						}
+					if(!ok) break;
+					}
+				else if(cmd=="QUIT") {
+					break;
+					}
+				else if(!io.write("ERR unknown command\n")) {
+					break;
+					}
+				}
+			}
+	public:
+		static const int MAX_SERVED_LENGTH = 250000000;
+		static const int MAX_SERVED_BINS = 100000;
+		/** holds the bams and the on-disk cache */
+		X11BamCov app;
+		/** max number of requests kept in memory */
+		size_t max_entries;
+
+		CoverageServer():max_entries(10000) {
+			}
+		void usage(std::ostream& out) {
+			out << "serve" << endl;
+			out << "Motivation:\n  Keeps a list of bams open and serves their coverage to 'x11hts cnv -S' on a unix socket." << endl;
+			out << "Options:\n";
+			out << "  -h print help and exit\n";
+			out << "  -B (FILE) list of path to indexed bam files\n";
+			out << "  -S (FILE) path of the unix socket\n";
+			out << "  -C (DIR) also cache the base-level coverage in this directory, see 'x11hts cnv -C'.\n";
+			out << "  -l (int) MAPQ threshold of the 'low MAPQ' signal. [" << app.low_mapq << "]\n";
+			out << "  -x (FLAGS) skip the reads having any of these flags, see 'x11hts cnv'. [" << app.filter.exclude_flags << "]\n";
+			out << "  -i (FLAGS) skip the reads not having all of these flags. [" << app.filter.require_flags << "]\n";
+			out << "  -q (int) skip the reads with a MAPQ lower than this value. [" << app.filter.min_mapq << "]\n";
+			out << "  -Q (int) don't count the aligned bases with a base quality lower than this value in the depth. [" << app.filter.min_base_qual << "]\n";
+			out << "  -m (int) number of binned coverages kept in memory. [" << max_entries << "]\n";
+			}
+		int doWork(int argc,char** argv) {
+			char* bam_list = NULL;
+			char* socket_path = NULL;
+			int opt;
+			while ((opt = getopt(argc, argv, "B:S:C:l:m:x:i:q:Q:h")) != -1) {
+				switch (opt) {
+				case 'h':
+					usage(cout);
+					return 0;
+				case 'B':
+					bam_list = optarg;
+					break;
+				case 'S':
+					socket_path = optarg;
+					break;
+				case 'C':
+					if(app.cache!=NULL) delete app.cache;
+					app.cache = new CoverageCache(optarg);
+					break;
+				case 'l':
+					app.low_mapq = parseInt(optarg);
+					break;
+				case 'x':
+					app.filter.exclude_flags = parseFlags(optarg);
+					break;
+				case 'i':
+					app.filter.require_flags = parseFlags(optarg);
+					break;
+				case 'q':
+					app.filter.min_mapq = parseInt(optarg);
+					break;
+				case 'Q':
+					app.filter.min_base_qual = parseInt(optarg);
+					break;
+				case 'm':
+					this->max_entries = (size_t)parseInt(optarg);
+					break;
+				default:
+					cerr << "unknown option" << endl;
+					return EXIT_FAILURE;
+				}
+			}
+			if(optind!=argc || bam_list==NULL || socket_path==NULL) {
+				usage(cerr);
+				return EXIT_FAILURE;
+				}
+			if(!app.loadBams(bam_list)) {
+				return EXIT_FAILURE;
+				}
+			struct sockaddr_un addr;
+			if(strlen(socket_path)>=sizeof(addr.sun_path)) {
+				cerr << "Socket path is too long: " << socket_path << endl;
+				return EXIT_FAILURE;
+				}
+			int fd = ::socket(AF_UNIX,SOCK_STREAM,0);
+			if(fd<0) {
+				cerr << "Cannot create socket. " << ::strerror(errno) << endl;
+				return EXIT_FAILURE;
+				}
+			memset(&addr,0,sizeof(addr));
+			addr.sun_family = AF_UNIX;
+			strcpy(addr.sun_path,socket_path);
+			::unlink(socket_path);
+			if(::bind(fd,(struct sockaddr*)&addr,sizeof(addr))!=0 || ::listen(fd,64)!=0) {
+				cerr << "Cannot listen on " << socket_path << ". " << ::strerror(errno) << endl;
+				::close(fd);
+				return EXIT_FAILURE;
+				}
+			cerr << "[INFO] serving " << app.bams.size() << " bam(s) on " << socket_path << endl;
+			for(;;) {
+				int client = ::accept(fd,NULL,NULL);
+				if(client<0) {
+					if(errno==EINTR) continue;
+					cerr << "[WARN] accept failed. " << ::strerror(errno) << endl;
+					continue;
+					}
+				std::thread(&CoverageServer::handle,this,client).detach();
+				}
+			return 0;
+			}
+	};
+
+int main_serve(int argc,char** argv) {
+	CoverageServer server;
+	return server.doWork(argc,argv);
+	}
+
 int main_cnv(int argc,char** argv) {
 	X11BamCov app;
 	return app.doWork(argc,argv);
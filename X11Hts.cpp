@@ -29,11 +29,13 @@ THE SOFTWARE.
 using namespace std;
 
 extern int main_cnv(int argc,char** argv);
+extern int main_serve(int argc,char** argv);
 
 static void usage(std::ostream& out) {
 out << "x11hts\nAuthor: Pierre Lindenbaum PhD.\nCompilation: " << __DATE__ << endl;
 out << "Usage:" << endl;
 out << "    x11hts cnv [options]" << endl;
+out << "    x11hts serve [options]" << endl;
 out << endl;
 }
 
@@ -46,6 +48,9 @@ int main(int argc,char** argv) {
 		if(strcmp(argv[1],"cnv")==0) {
 			return main_cnv(argc-1,&argv[1]);
 			}
+		else if(strcmp(argv[1],"serve")==0) {
+			return main_serve(argc-1,&argv[1]);
+			}
 		else
 			{
 			cerr << "unknown command \""<< argv[1] << "\"." << endl;